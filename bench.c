@@ -0,0 +1,303 @@
+/***************************************************************************
+ * Author: Nikos Karampatziakis <nk@cs.cornell.edu>, Copyright (C) 2008    *
+ *                                                                         *
+ * Description: Benchmark driver. Times loading, sorting, growing, writing *
+ *              reading and classifying and prints the results as CSV or   *
+ *              JSON so that they can be compared across versions.         *
+ *                                                                         *
+ * License: See LICENSE file that comes with this distribution             *
+ ***************************************************************************/
+
+#include "dataset.h"
+#include "tree.h"
+#include "forest.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+typedef struct result_t{
+    const char* phase;
+    int committee;  /* 0 for the phases that do not depend on it */
+    double wall;    /* seconds, the fastest of the repetitions */
+    double cpu;     /* seconds of cpu time of that repetition */
+    double items;   /* examples, pairs, trees or bytes processed */
+    const char* unit;
+}result_t;
+
+typedef struct bench_t{
+    result_t* result;
+    int nresult;
+    double start[2];
+}bench_t;
+
+static double seconds(clockid_t clock){
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+static void startTimer(bench_t* b){
+    b->start[0] = seconds(CLOCK_MONOTONIC);
+    b->start[1] = seconds(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+/* Stop the timer of repetition rep of a phase and keep it if it is the fastest */
+static void stopTimer(bench_t* b, int rep, const char* phase, int committee, double items, const char* unit){
+    double wall = seconds(CLOCK_MONOTONIC) - b->start[0];
+    double cpu = seconds(CLOCK_PROCESS_CPUTIME_ID) - b->start[1];
+    result_t* r;
+    if(rep == 0){
+        b->result = realloc(b->result, (b->nresult+1)*sizeof(result_t));
+        r = &b->result[b->nresult++];
+        r->phase = phase;
+        r->committee = committee;
+        r->items = items;
+        r->unit = unit;
+    }
+    else{
+        r = &b->result[b->nresult-1];
+        if(wall >= r->wall)
+            return;
+    }
+    r->wall = wall;
+    r->cpu = cpu;
+}
+
+/* The pairs of d in the order in which they are read: by example. Returns
+ * their number; fm/em hold the feature and the pair, row[x] is the offset
+ * of the first pair of example x. */
+static int examplePairs(dataset_t* d, int** fm, evpair_t** em, int** row){
+    int i,j,x,v,total;
+    int* next;
+    evpair_t* buf = columnBuffer(d);
+    evpair_t* b;
+    dense_t* dn;
+
+    *row = calloc(d->nex+1, sizeof(int));
+    for(i=0; i<d->nfeat; i++){
+        if((dn = d->dense[i])){
+            for(x=0; x<d->nex; x++)
+                (*row)[x+1] += dn->bin[x] != dn->zero;
+            continue;
+        }
+        b = getColumn(d, i, buf);
+        for(j=0; j<d->size[i]; j++)
+            (*row)[b[j].example+1] += 1;
+    }
+    for(x=0; x<d->nex; x++)
+        (*row)[x+1] += (*row)[x];
+    total = (*row)[d->nex];
+    *fm = malloc((total>0 ? total : 1)*sizeof(int));
+    *em = malloc((total>0 ? total : 1)*sizeof(evpair_t));
+    next = malloc(d->nex*sizeof(int));
+    memcpy(next, *row, d->nex*sizeof(int));
+    for(i=0; i<d->nfeat; i++){
+        if((dn = d->dense[i])){
+            for(x=0; x<d->nex; x++){
+                if(dn->bin[x] == dn->zero)
+                    continue;
+                v = next[x]++;
+                (*fm)[v] = i;
+                (*em)[v].example = x;
+                (*em)[v].value = dn->value[dn->bin[x]];
+            }
+            continue;
+        }
+        b = getColumn(d, i, buf);
+        for(j=0; j<d->size[i]; j++){
+            v = next[b[j].example]++;
+            (*fm)[v] = i;
+            (*em)[v] = b[j];
+        }
+    }
+    free(next);
+    free(buf);
+    return total;
+}
+
+static void printResults(bench_t* b, const char* label, const char* data, int trees, int nex, int json){
+    int i;
+    result_t* r;
+    if(json)
+        printf("[\n");
+    else
+        printf("label,data,phase,committee,trees,examples,wall,cpu,items,unit,rate\n");
+    for(i=0; i<b->nresult; i++){
+        r = &b->result[i];
+        if(json){
+            printf("  {\"label\": \"%s\", \"data\": \"%s\", \"phase\": \"%s\", \"committee\": %d, "
+                "\"trees\": %d, \"examples\": %d, \"wall\": %.6f, \"cpu\": %.6f, "
+                "\"items\": %.0f, \"unit\": \"%s\", \"rate\": %.6g}%s\n",
+                label, data, r->phase, r->committee, trees, nex, r->wall, r->cpu,
+                r->items, r->unit, r->wall > 0 ? r->items/r->wall : 0, i+1 < b->nresult ? "," : "");
+        }
+        else{
+            printf("%s,%s,%s,%d,%d,%d,%.6f,%.6f,%.0f,%s,%.6g\n",
+                label, data, r->phase, r->committee, trees, nex, r->wall, r->cpu,
+                r->items, r->unit, r->wall > 0 ? r->items/r->wall : 0);
+        }
+    }
+    if(json)
+        printf("]\n");
+}
+
+int main(int argc, char* argv[]){
+    dataset_t d;
+    forest_t f;
+    forest_t g;
+    bench_t b;
+    struct stat st;
+    char* tmpdir=getenv("TMPDIR");
+    char model[4096];
+    char* c;
+    char* committees=0;
+    char* label="";
+    int committee[8];
+    int ncommittee=0;
+    int option,fd,i,j,k,x,rep,total;
+    int trees=20;
+    int maxdepth=1000;
+    int reps=1;
+    int json=0;
+    int* fm;
+    int* fs;
+    int* row;
+    evpair_t* em;
+    evpair_t* es;
+    float* example;
+    volatile double sum; /* keeps the compiler from dropping the scores */
+    unsigned int seed=1;
+
+    const char* help="Usage: %s [options] data\nAvailable options:\n\
+    -c <list> : committee types to grow (default: 1,2,3,4)\n\
+    -d <int>  : maximum depth of the trees (default: 1000)\n\
+    -j        : print JSON instead of CSV\n\
+    -l <str>  : label of every result, e.g. the version (default: none)\n\
+    -r <int>  : repeat every measurement and keep the fastest (default: 1)\n\
+    -s <int>  : seed for the random number generator (default: 1)\n\
+    -t <int>  : number of trees (default: 20)\n";
+
+    while((option=getopt(argc,argv,"c:d:jl:r:s:t:"))!=EOF){
+        switch(option){
+            case 'c': committees=optarg; break;
+            case 'd': maxdepth=atoi(optarg); break;
+            case 'j': json=1; break;
+            case 'l': label=optarg; break;
+            case 'r': reps=atoi(optarg); break;
+            case 's': seed=strtoul(optarg,NULL,10); break;
+            case 't': trees=atoi(optarg); break;
+            case '?': fprintf(stderr,help,argv[0]); exit(1); break;
+        }
+    }
+    if(committees){
+        for(c=strtok(committees,","); c && ncommittee<8; c=strtok(NULL,","))
+            committee[ncommittee++] = atoi(c);
+    }
+    else{
+        for(i=BAGGING; i<=EXTRATREES; i++)
+            committee[ncommittee++] = i;
+    }
+    for(i=0; i<ncommittee; i++){
+        if(committee[i]!=BAGGING && committee[i]!=BOOSTING && committee[i]!=RANDOMFOREST && committee[i]!=EXTRATREES){
+            fprintf(stderr,"Unknown committee type\n");
+            exit(1);
+        }
+    }
+    if(trees<=0 || maxdepth<=0 || reps<=0){
+        fprintf(stderr,"Invalid parameters\n");
+        exit(1);
+    }
+    if(argc - optind != 1){
+        fprintf(stderr,help,argv[0]);
+        exit(1);
+    }
+    snprintf(model, sizeof(model), "%s/festbenchXXXXXX", tmpdir ? tmpdir : "/tmp");
+    fd = mkstemp(model);
+    if(fd < 0){
+        fprintf(stderr,"could not create a temporary file in %s\n",tmpdir ? tmpdir : "/tmp");
+        exit(1);
+    }
+    close(fd);
+    b.result = NULL;
+    b.nresult = 0;
+
+    for(rep=0; rep<reps; rep++){
+        if(rep > 0)
+            freeData(&d);
+        srand(seed);
+        startTimer(&b);
+        loadData(argv[optind], &d);
+        stopTimer(&b, rep, "load", 0, d.nex, "examples");
+    }
+
+    /* Sort the pairs again starting from the order in which they were read */
+    total = examplePairs(&d, &fm, &em, &row);
+    fs = malloc((total>0 ? total : 1)*sizeof(int));
+    es = malloc((total>0 ? total : 1)*sizeof(evpair_t));
+    for(rep=0; rep<reps; rep++){
+        memcpy(fs, fm, total*sizeof(int));
+        memcpy(es, em, total*sizeof(evpair_t));
+        srand(seed);
+        startTimer(&b);
+        sort(es, fs, total);
+        stopTimer(&b, rep, "sort", 0, total, "pairs");
+    }
+    free(fs);
+    free(es);
+
+    example = calloc(d.nfeat, sizeof(float));
+    for(k=0; k<ncommittee; k++){
+        for(rep=0; rep<reps; rep++){
+            initForest(&f, committee[k], maxdepth, 1, trees, 1, 0, seed);
+            startTimer(&b);
+            growForest(&f, &d);
+            stopTimer(&b, rep, "grow", committee[k], f.ngrown, "trees");
+            if(rep+1 < reps)
+                freeForest(&f);
+        }
+        for(rep=0; rep<reps; rep++){
+            startTimer(&b);
+            writeForest(&f, model);
+            stat(model, &st);
+            stopTimer(&b, rep, "write", committee[k], st.st_size, "bytes");
+        }
+        for(rep=0; rep<reps; rep++){
+            startTimer(&b);
+            readForest(&g, model);
+            stopTimer(&b, rep, "read", committee[k], st.st_size, "bytes");
+            freeForest(&g);
+        }
+        /* The leaves of the grown trees only have their masses. Store the
+         * outputs that classifyForest reads, as readForest does */
+        for(j=0; j<f.ngrown; j++)
+            setOutputs(f.tree[j], f.committee);
+        /* Only the scoring is timed: the examples are already parsed and
+         * each one is scattered into the dense vector the trees read */
+        for(rep=0; rep<reps; rep++){
+            sum = 0;
+            startTimer(&b);
+            for(x=0; x<d.nex; x++){
+                for(j=row[x]; j<row[x+1]; j++)
+                    example[fm[j]] = em[j].value;
+                sum += classifyForest(&f, example);
+                for(j=row[x]; j<row[x+1]; j++)
+                    example[fm[j]] = 0;
+            }
+            stopTimer(&b, rep, "classify", committee[k], d.nex, "examples");
+        }
+        freeForest(&f);
+    }
+    unlink(model);
+    printResults(&b, label, argv[optind], trees, d.nex, json);
+    free(example);
+    free(fm);
+    free(em);
+    free(row);
+    free(b.result);
+    freeData(&d);
+    return 0;
+}
@@ -9,28 +9,112 @@
 #include "dataset.h"
 #include "tree.h"
 #include "forest.h"
+#include "metrics.h"
+#include "stats.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <getopt.h>
+#include <string.h>
+
+static int increasing(const void* a, const void* b){
+    return *(const int*)a - *(const int*)b;
+}
+
+/* Parse a comma separated list of tree counts into an increasing array */
+int parsePrefixes(char* list, int** prefix){
+    int i,n,len;
+    char* c;
+    for(n=1, c=list; *c; c++)
+        n += *c == ',';
+    *prefix = malloc(n*sizeof(int));
+    for(i=0, c=strtok(list,","); c; c=strtok(NULL,",")){
+        (*prefix)[i] = atoi(c);
+        if((*prefix)[i] <= 0){
+            fprintf(stderr,"Invalid number of trees: %s\n",c);
+            exit(1);
+        }
+        i++;
+    }
+    qsort(*prefix,i,sizeof(int),increasing);
+    for(n=0, len=0; n<i; n++){
+        if(len == 0 || (*prefix)[len-1] != (*prefix)[n])
+            (*prefix)[len++] = (*prefix)[n];
+    }
+    return len;
+}
+
+/* Union of the features of the models, in increasing order of id. Returns
+ * its size and leaves featid NULL when it is just 0..nfeat-1 */
+int unionFeatures(forest_t* f, int nmodels, int** featid){
+    int i,j,n,len,id;
+    for(n=0, i=0; i<nmodels; i++)
+        n += f[i].nfeat;
+    *featid = malloc((n+1)*sizeof(int));
+    for(n=0, i=0; i<nmodels; i++){
+        for(j=0; j<f[i].nfeat; j++)
+            (*featid)[n++] = f[i].featid ? f[i].featid[j] : j;
+    }
+    qsort(*featid,n,sizeof(int),increasing);
+    for(i=0, len=0; i<n; i++){
+        if(len == 0 || (*featid)[len-1] != (*featid)[i])
+            (*featid)[len++] = (*featid)[i];
+    }
+    for(id=0; id<len && (*featid)[id] == id; id++)
+        ;
+    if(id == len){
+        free(*featid);
+        *featid = NULL;
+    }
+    return len;
+}
 
 int main(int argc, char* argv[]){
     float* example;
-    int maxline,target,nf,nex;
+    int target,size;
     float p;
-    forest_t f;
+    forest_t* f;
     FILE* fp;
     FILE* fq;
     int trees=0;
+    int early=0;
+    int evaluated;
+    int i,j,m,n;
+    int nmodels;
+    int nfeat;
+    int* featid;
+    int nprefix=0;
+    int* prefix=0;
+    int* targets=0;
+    int* active=0;
+    int nactive=0;
+    unsigned char* mark=0;
+    int sparse;
+    float* pred=0;
     char* input=0;
-    char* model=0;
     char* preds=0;
+    char* stats=0;
+    double start=0;
+    long visited,nodes;
+    char* line=0;
+    size_t cap=0;
     int option;
 
-    const char* help="Usage: %s [options] data model predictions\nAvailable options:\n\
+    const char* help="Usage: %s [options] data model [model ...] predictions\nUse - as data to read the standard input.\n\
+With several models every example is read once and each model writes a column.\nAvailable options:\n\
+            -e        : stop evaluating trees once the decision is certain and\n\
+                        also output the number of trees evaluated (default: no)\n\
+            -i <file> : write statistics (times, memory, trees and nodes visited\n\
+                        per example) to this file as JSON\n\
+            -k <list> : output predictions of the first k trees for each k in\n\
+                        the comma separated list and report their error/AUC\n\
+                        (only with one model)\n\
             -t <int>  : number of trees to use (default: 0 = all)\n";
 
-    while((option=getopt(argc,argv,"t:"))!=EOF){
+    while((option=getopt(argc,argv,"ei:k:t:"))!=EOF){
         switch(option){
+            case 'e': early=1; break;
+            case 'i': stats=optarg; break;
+            case 'k': nprefix=parsePrefixes(optarg,&prefix); break;
             case 't': trees=atoi(optarg); break;
             case '?': fprintf(stderr,help,argv[0]); exit(1); break;
         }
@@ -39,24 +123,55 @@ int main(int argc, char* argv[]){
         fprintf(stderr,"Invalid number of trees\n");
         exit(1);
     }
-    if(argc - optind == 3){
+    if(early && nprefix > 0){
+        fprintf(stderr,"Options -e and -k cannot be combined\n");
+        exit(1);
+    }
+    if(argc - optind >= 3){
         input = argv[optind];
-        model = argv[optind+1];
-        preds = argv[optind+2];
+        preds = argv[argc-1];
+        nmodels = argc - optind - 2;
     }
     else{
         fprintf(stderr,help,argv[0]); 
         exit(1);
     }
-    readForest(&f, model);
-    if(trees > f.ngrown){
+    if(nprefix > 0 && nmodels > 1){
+        fprintf(stderr,"Option -k works with only one model\n");
+        exit(1);
+    }
+    if(stats)
+        startStats();
+    f = malloc(nmodels*sizeof(forest_t));
+    for(m=0; m<nmodels; m++){
+        readForest(&f[m], argv[optind+1+m]);
+        if(trees > f[m].ngrown){
+            fprintf(stderr,"Too many trees specified for this ensemble\n");
+            fprintf(stderr,"Adjusting to %d\n",f[m].ngrown);
+        }
+        else if(trees > 0)
+            f[m].ngrown=trees;
+    }
+    if(nprefix > 0 && prefix[nprefix-1] > f[0].ngrown){
         fprintf(stderr,"Too many trees specified for this ensemble\n");
-        fprintf(stderr,"Adjusting to %d\n",f.ngrown);
-        trees = f.ngrown;
+        for(n=0; n<nprefix && prefix[n] < f[0].ngrown; n++)
+            ;
+        prefix[n] = f[0].ngrown;
+        nprefix = n+1;
+        fprintf(stderr,"Adjusting the largest to %d\n",f[0].ngrown);
+    }
+    /* The models may have been trained on different features, so they are
+     * renumbered to share one example vector over the union of them */
+    if(nmodels > 1){
+        nfeat = unionFeatures(f, nmodels, &featid);
+        for(m=0; m<nmodels; m++)
+            renumberForest(&f[m], featid, nfeat);
     }
-    if(trees > 0)
-        f.ngrown=trees;
-    fp = fopen(input,"r");
+    else{
+        nfeat = f[0].nfeat;
+        featid = f[0].featid;
+    }
+    fp = openData(input);
     if (fp == NULL){
         fprintf(stderr,"Could not open test data file\n");
         exit(1);
@@ -67,16 +182,97 @@ int main(int argc, char* argv[]){
         exit(1);
     }
 
-    maxline = getDimensions(fp,&nex,&nf);
-    rewind(fp);
-    example=malloc(f.nfeat*sizeof(float));
-    while(readExample(fp, maxline, example, f.nfeat, &target)){
-        p=classifyForest(&f,example);
-        fprintf(fq,"%f\n",p);
+    /* Plain predictions only walk the trees that the nonzero features of
+     * each example can send off their all-zero path (see indexForest) */
+    sparse = !early && nprefix == 0;
+    if(sparse){
+        for(n=0, m=0; m<nmodels; m++){
+            indexForest(&f[m]);
+            n = f[m].ngrown > n ? f[m].ngrown : n;
+        }
+        mark=calloc(n+1,sizeof(unsigned char));
+        active=malloc((nfeat+1)*sizeof(int));
+    }
+    example=calloc(nfeat+1,sizeof(float));
+    size=1024;
+    if(nprefix > 0){
+        pred=malloc(size*nprefix*sizeof(float));
+        targets=malloc(size*sizeof(int));
+    }
+    n=0;
+    while(sparse ? readSparseExample(fp, &line, &cap, example, nfeat, featid, &target, active, &nactive)
+                 : readExample(fp, &line, &cap, example, nfeat, featid, &target)){
+        if(nprefix > 0 && n == size){
+            size *= 2;
+            pred=realloc(pred,size*nprefix*sizeof(float));
+            targets=realloc(targets,size*sizeof(int));
+        }
+        if(nprefix > 0){
+            if(stats)
+                start=wallClock();
+            classifyForestPrefixes(&f[0],example,prefix,nprefix,pred+n*nprefix);
+            evaluated=prefix[nprefix-1];
+            if(stats){
+                addPhase(CLASSIFY, wallClock()-start);
+                addClassifyStats(1, evaluated, nodesVisited(&f[0], example, evaluated));
+            }
+            for(j=0; j<nprefix; j++)
+                fprintf(fq,j ? " %f" : "%f",pred[n*nprefix+j]);
+            fprintf(fq,"\n");
+            targets[n++]=target;
+            continue;
+        }
+        visited=nodes=0;
+        for(m=0; m<nmodels; m++){
+            if(stats)
+                start=wallClock();
+            if(early)
+                p=classifyForestEarly(&f[m],example,&evaluated);
+            else
+                p=classifyForestSparse(&f[m],example,active,nactive,mark,&evaluated,stats ? &nodes : NULL);
+            if(stats){
+                addPhase(CLASSIFY, wallClock()-start);
+                visited += evaluated;
+                if(early)
+                    nodes += nodesVisited(&f[m], example, evaluated);
+            }
+            if(early)
+                fprintf(fq,m ? " %f %d" : "%f %d",p,evaluated);
+            else
+                fprintf(fq,m ? " %f" : "%f",p);
+        }
+        fprintf(fq,"\n");
+        if(stats)
+            addClassifyStats(1, visited, nodes);
+    }
+    if(nprefix > 0){
+        /* Gather the predictions of each prefix to evaluate it */
+        float* column=malloc(n*sizeof(float));
+        printf("%5s  %6s  %6s\n","trees","err","auc");
+        for(j=0; j<nprefix; j++){
+            for(i=0; i<n; i++)
+                column[i]=pred[i*nprefix+j];
+            printf("%5d  %5.2f%%  %6.4f\n",prefix[j],
+                100*errorRate(column,targets,n,f[0].committee == BOOSTING ? 0 : 0.5),
+                areaUnderROC(column,targets,n));
+        }
+        free(column);
+        free(pred);
+        free(targets);
+        free(prefix);
     }
     free(example);
-    fclose(fp);
+    free(active);
+    free(mark);
+    free(line);
+    closeData(fp);
     fclose(fq);
-    freeForest(&f);
+    if(stats)
+        writeStats(stats, "festclassify");
+    if(nmodels > 1)
+        free(featid);
+    for(m=0; m<nmodels; m++)
+        freeForest(&f[m]);
+    free(f);
     return 0;
 }
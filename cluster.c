@@ -0,0 +1,489 @@
+/***************************************************************************
+ * Author: Nikos Karampatziakis <nk@cs.cornell.edu>, Copyright (C) 2008    *
+ *                                                                         *
+ * Description: Growing trees with several processes. Every worker holds   *
+ *              the features whose id is its rank modulo the number of     *
+ *              workers, and finds the best split among them. The          *
+ *              coordinator picks the best of these and passes on the      *
+ *              examples that the split moves.                             *
+ *                                                                         *
+ * License: See LICENSE file that comes with this distribution             *
+ ***************************************************************************/
+
+#include "cluster.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/* All the processes grow the same tree in lockstep: growrec runs everywhere
+ * and only bestSplit, the root and the examples moved by a split are sent
+ * around. Every worker draws the same samples and the same random features
+ * from the same seeds, and the best split is broken by its position in the
+ * features of the node like in bestSplit, so the trees are the ones that a
+ * single process would grow. The messages are in the byte order of the
+ * machine, so all the processes must run on the same kind of machine.
+ */
+
+/* A best split of a worker, or the winner that the coordinator sends back */
+typedef struct candidate_t{
+    split_t split;
+    int position; /* of the feature in tree->feats, for ties */
+    int owner;
+}candidate_t;
+
+static void sendAll(int fd, const void* buf, size_t n){
+    const char* p = buf;
+    ssize_t k;
+    while(n > 0){
+        k = send(fd, p, n, MSG_NOSIGNAL);
+        if(k < 0 && errno == EINTR)
+            continue;
+        if(k <= 0){
+            fprintf(stderr,"Lost the connection to another process\n");
+            exit(1);
+        }
+        p += k;
+        n -= k;
+    }
+}
+
+static void recvAll(int fd, void* buf, size_t n){
+    char* p = buf;
+    ssize_t k;
+    while(n > 0){
+        k = recv(fd, p, n, 0);
+        if(k < 0 && errno == EINTR)
+            continue;
+        if(k <= 0){
+            fprintf(stderr,"Lost the connection to another process\n");
+            exit(1);
+        }
+        p += k;
+        n -= k;
+    }
+}
+
+/* host:port is a TCP address, anything else is the path of a Unix domain
+ * socket. A server listens on the address, a client connects to it and
+ * keeps trying for a while, since the server may still be starting. */
+static int openAddress(const char* address, int server){
+    struct sockaddr_un un;
+    struct addrinfo hints;
+    struct addrinfo* ai;
+    const char* port = strrchr(address, ':');
+    char* host;
+    int fd,tries,one=1;
+
+    if(port && !strchr(address, '/')){
+        host = malloc(port-address+1);
+        memcpy(host, address, port-address);
+        host[port-address] = '\0';
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = server ? AI_PASSIVE : 0;
+        if(getaddrinfo(host[0] ? host : NULL, port+1, &hints, &ai) != 0){
+            fprintf(stderr,"Unknown address %s\n",address);
+            exit(1);
+        }
+        free(host);
+    }
+    else{
+        if(strlen(address) >= sizeof(un.sun_path)){
+            fprintf(stderr,"Socket name too long: %s\n",address);
+            exit(1);
+        }
+        memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        strcpy(un.sun_path, address);
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNIX;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_addr = (struct sockaddr*)&un;
+        hints.ai_addrlen = sizeof(un);
+        ai = &hints;
+        if(server)
+            unlink(address);
+    }
+    for(tries=0; ; tries++){
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if(fd < 0)
+            break;
+        if(server){
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if(bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 1) == 0)
+                break;
+        }
+        else if(connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+        if(server || tries == 100)
+            break;
+        usleep(100000);
+    }
+    if(fd < 0){
+        fprintf(stderr,"Could not %s %s\n",server ? "listen on" : "connect to",address);
+        exit(1);
+    }
+    if(ai->ai_family != AF_UNIX){
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        freeaddrinfo(ai);
+    }
+    return fd;
+}
+
+static void initStack(cluster_t* c){
+    c->depth = 0;
+    c->size = 0;
+    c->ex = NULL;
+    c->nex = NULL;
+    c->cap = NULL;
+    c->nbits = 0;
+    c->bits = NULL;
+}
+
+static int byId(const void* a, const void* b){
+    return ((const int*)a)[0] - ((const int*)b)[0];
+}
+
+/* Connect to the workers at the comma separated addresses, send them the
+ * parameters of f and gather their features. d gets the features of all
+ * of them and no examples, which is all that growForest needs here. */
+void startCluster(cluster_t* c, forest_t* f, dataset_t* d, char* workers){
+    job_t job;
+    int i,j,k,n,nex,total;
+    int* feat;   /* id, cont and worker of every feature */
+    int* featid;
+    int* cont;
+    char* a;
+
+    for(n=1, a=workers; *a; a++)
+        n += *a == ',';
+    c->rank = -1;
+    c->nworkers = n;
+    c->fd = malloc(n*sizeof(int));
+    for(i=0, a=strtok(workers,","); a; a=strtok(NULL,","))
+        c->fd[i++] = openAddress(a, 0);
+    job.nworkers = n;
+    job.committee = f->committee;
+    job.maxdepth = f->maxdepth;
+    job.ntrees = f->ntrees;
+    job.bootstrap = f->bootstrap;
+    job.replace = f->replace;
+    job.factor = f->factor;
+    job.wneg = f->wneg;
+    job.rate[0] = f->rate[0];
+    job.rate[1] = f->rate[1];
+    job.seed = f->seed;
+    for(i=0; i<n; i++){
+        job.rank = i;
+        sendAll(c->fd[i], &job, sizeof(job));
+    }
+
+    /* Every worker has loaded its shard and sends its features */
+    feat = NULL;
+    total = 0;
+    for(i=0; i<n; i++){
+        recvAll(c->fd[i], &k, sizeof(int));
+        if(i == 0)
+            nex = k;
+        else if(k != nex){
+            fprintf(stderr,"The workers have different numbers of examples\n");
+            exit(1);
+        }
+        recvAll(c->fd[i], &k, sizeof(int));
+        feat = realloc(feat, 3*(total+k+1)*sizeof(int));
+        featid = malloc((k+1)*sizeof(int));
+        cont = malloc((k+1)*sizeof(int));
+        recvAll(c->fd[i], featid, k*sizeof(int));
+        recvAll(c->fd[i], cont, k*sizeof(int));
+        for(j=0; j<k; j++){
+            feat[3*(total+j)] = featid[j];
+            feat[3*(total+j)+1] = cont[j];
+            feat[3*(total+j)+2] = i;
+        }
+        total += k;
+        free(featid);
+        free(cont);
+    }
+    qsort(feat, total, 3*sizeof(int), byId);
+    featid = malloc((total+1)*sizeof(int));
+    cont = malloc((total+1)*sizeof(int));
+    for(k=1, j=0; j<total; j++){
+        if(j > 0 && feat[3*j] == feat[3*(j-1)]){
+            fprintf(stderr,"Feature %d is on workers %d and %d\n",feat[3*j],feat[3*(j-1)+2],feat[3*j+2]);
+            exit(1);
+        }
+        featid[j] = feat[3*j];
+        cont[j] = feat[3*j+1];
+        k = k && featid[j] == j;
+    }
+    free(feat);
+    /* Like loadData, the ids are kept only if some are missing, and ids
+     * from 1 get an empty feature 0 */
+    if(total > 0 && featid[0] == 1 && featid[total-1] == total){
+        memmove(featid+1, featid, total*sizeof(int));
+        memmove(cont+1, cont, total*sizeof(int));
+        featid[0] = cont[0] = 0;
+        total += 1;
+        k = 1;
+    }
+    for(i=0; i<n; i++){
+        sendAll(c->fd[i], &total, sizeof(int));
+        sendAll(c->fd[i], &k, sizeof(int));
+        if(!k)
+            sendAll(c->fd[i], featid, total*sizeof(int));
+        sendAll(c->fd[i], cont, total*sizeof(int));
+    }
+    emptyData(d, total, k ? NULL : featid, cont);
+    free(featid);
+    free(cont);
+    initStack(c);
+    f->cluster = c;
+}
+
+/* Wait for the coordinator on address, load the shard of the data that it
+ * assigns and number its features like the other workers do */
+void joinCluster(cluster_t* c, forest_t* f, dataset_t* d, const char* address, const char* data, int pack){
+    job_t job;
+    int i,n,same;
+    int* featid;
+    int* cont;
+    int lfd = openAddress(address, 1);
+
+    c->fd = malloc(sizeof(int));
+    c->fd[0] = accept(lfd, NULL, NULL);
+    if(c->fd[0] < 0){
+        fprintf(stderr,"Could not accept a connection on %s\n",address);
+        exit(1);
+    }
+    close(lfd);
+    if(!strchr(address, ':') || strchr(address, '/'))
+        unlink(address);
+    recvAll(c->fd[0], &job, sizeof(job));
+    c->rank = job.rank;
+    c->nworkers = job.nworkers;
+    initForest(f, job.committee, job.maxdepth, job.factor, job.ntrees, job.wneg, 0, job.seed);
+    f->bootstrap = job.bootstrap;
+    f->rate[0] = job.rate[0];
+    f->rate[1] = job.rate[1];
+    f->replace = job.replace;
+
+    if(pack)
+        loadPackedData(data, d, c->nworkers, c->rank);
+    else
+        loadShard(data, d, c->nworkers, c->rank);
+    /* Only the features that have pairs here, so that the empty feature 0
+     * of ids from 1 (see loadData) is not claimed by every worker */
+    featid = malloc((d->nfeat+1)*sizeof(int));
+    cont = malloc((d->nfeat+1)*sizeof(int));
+    for(i=0, n=0; i<d->nfeat; i++){
+        if(d->size[i] == 0)
+            continue;
+        featid[n] = d->featid ? d->featid[i] : i;
+        cont[n++] = d->cont[i];
+    }
+    sendAll(c->fd[0], &d->nex, sizeof(int));
+    sendAll(c->fd[0], &n, sizeof(int));
+    sendAll(c->fd[0], featid, n*sizeof(int));
+    sendAll(c->fd[0], cont, n*sizeof(int));
+    free(featid);
+    free(cont);
+
+    recvAll(c->fd[0], &n, sizeof(int));
+    recvAll(c->fd[0], &same, sizeof(int));
+    featid = malloc((n+1)*sizeof(int));
+    cont = malloc((n+1)*sizeof(int));
+    if(!same)
+        recvAll(c->fd[0], featid, n*sizeof(int));
+    recvAll(c->fd[0], cont, n*sizeof(int));
+    alignData(d, same ? NULL : featid, n);
+    /* The features of the other workers are empty here, but whether they
+     * are continuous decides which ones a split uses up */
+    memcpy(d->cont, cont, n*sizeof(int));
+    free(featid);
+    free(cont);
+    initStack(c);
+    f->cluster = c;
+}
+
+void stopCluster(cluster_t* c){
+    int i;
+    for(i=0; i<(c->rank < 0 ? c->nworkers : 1); i++)
+        close(c->fd[i]);
+    for(i=0; i<c->size; i++)
+        free(c->ex[i]);
+    free(c->fd);
+    free(c->ex);
+    free(c->nex);
+    free(c->cap);
+    free(c->bits);
+}
+
+/* The first worker tells the coordinator the masses at the root */
+void clusterRoot(cluster_t* c, node_t* root){
+    float mass[2];
+    if(c->rank == 0){
+        mass[0] = root->pos;
+        mass[1] = root->neg;
+        sendAll(c->fd[0], mass, sizeof(mass));
+    }
+    else if(c->rank < 0){
+        recvAll(c->fd[0], mass, sizeof(mass));
+        root->pos = mass[0];
+        root->neg = mass[1];
+    }
+}
+
+/* The best split of root over the features of all the workers */
+split_t clusterSplit(tree_t* t, node_t* root, dataset_t* d){
+    cluster_t* c = t->cluster;
+    candidate_t cand,best;
+    int i;
+
+    if(c->rank >= 0){
+        cand.split = bestSplit(t, root, d);
+        cand.position = -1;
+        for(i=0; i<t->fpn && cand.split.feature >= 0; i++){
+            if(t->feats[i] == cand.split.feature){
+                cand.position = i;
+                break;
+            }
+        }
+        cand.owner = c->rank;
+        sendAll(c->fd[0], &cand, sizeof(cand));
+        recvAll(c->fd[0], &best, sizeof(best));
+        c->owner = best.owner;
+        return best.split;
+    }
+    best.split.feature = -1;
+    best.owner = -1;
+    for(i=0; i<c->nworkers; i++){
+        recvAll(c->fd[i], &cand, sizeof(cand));
+        if(cand.split.feature < 0)
+            continue;
+        if(best.split.feature < 0 || cand.split.gain > best.split.gain ||
+                (cand.split.gain == best.split.gain && cand.position < best.position)){
+            best = cand;
+            best.owner = i;
+        }
+    }
+    for(i=0; i<c->nworkers; i++)
+        sendAll(c->fd[i], &best, sizeof(best));
+    c->owner = best.owner;
+    return best.split;
+}
+
+static void roomForBits(cluster_t* c, int n){
+    if(n > c->nbits){
+        c->nbits = n;
+        c->bits = realloc(c->bits, n);
+    }
+}
+
+/* The examples moved by a split go as a list of ids, or as a bitmap of all
+ * the examples if that is shorter, which is the case near the root */
+static void sendExamples(cluster_t* c, int fd, const int* ex, int n, int nex){
+    int i,head[2];
+    head[0] = n;
+    head[1] = (nex+7)/8;
+    if(4L*n <= head[1]){
+        head[1] = 0;
+        sendAll(fd, head, sizeof(head));
+        sendAll(fd, ex, n*sizeof(int));
+        return;
+    }
+    roomForBits(c, head[1]);
+    memset(c->bits, 0, head[1]);
+    for(i=0; i<n; i++)
+        c->bits[ex[i]>>3] |= 1<<(ex[i]&7);
+    sendAll(fd, head, sizeof(head));
+    sendAll(fd, c->bits, head[1]);
+}
+
+static int recvExamples(cluster_t* c, int fd, int k){
+    int i,j,n,head[2];
+    recvAll(fd, head, sizeof(head));
+    n = head[0];
+    if(n > c->cap[k]){
+        c->cap[k] = n;
+        c->ex[k] = realloc(c->ex[k], n*sizeof(int));
+    }
+    if(head[1] == 0){
+        recvAll(fd, c->ex[k], n*sizeof(int));
+        return n;
+    }
+    roomForBits(c, head[1]);
+    recvAll(fd, c->bits, head[1]);
+    for(n=0, i=0; i<head[1]; i++){
+        if(c->bits[i] == 0)
+            continue;
+        for(j=0; j<8; j++){
+            if(c->bits[i] & (1<<j))
+                c->ex[k][n++] = 8*i+j;
+        }
+    }
+    return n;
+}
+
+/* The coordinator only passes the examples on */
+static void relayExamples(cluster_t* c){
+    int i,head[2];
+    size_t len;
+    recvAll(c->fd[c->owner], head, sizeof(head));
+    len = head[1] ? (size_t)head[1] : head[0]*sizeof(int);
+    roomForBits(c, len);
+    recvAll(c->fd[c->owner], c->bits, len);
+    for(i=0; i<c->nworkers; i++){
+        if(i == c->owner)
+            continue;
+        sendAll(c->fd[i], head, sizeof(head));
+        sendAll(c->fd[i], c->bits, len);
+    }
+}
+
+/* The split best was installed: the worker that has its feature finds the
+ * valid examples that it moves and everyone else gets them */
+void pushSplit(tree_t* t, dataset_t* d, split_t* best){
+    cluster_t* c = t->cluster;
+    int k = c->depth++;
+    if(k == c->size){
+        c->size = 2*c->size + 8;
+        c->ex = realloc(c->ex, c->size*sizeof(int*));
+        c->nex = realloc(c->nex, c->size*sizeof(int));
+        c->cap = realloc(c->cap, c->size*sizeof(int));
+        memset(c->ex+k, 0, (c->size-k)*sizeof(int*));
+        memset(c->cap+k, 0, (c->size-k)*sizeof(int));
+    }
+    c->nex[k] = 0;
+    if(c->rank < 0)
+        relayExamples(c);
+    else if(c->owner == c->rank){
+        if(d->nex > c->cap[k]){
+            c->cap[k] = d->nex;
+            c->ex[k] = realloc(c->ex[k], d->nex*sizeof(int));
+        }
+        c->nex[k] = markSplit(t, d, best->feature, best->threshold, c->ex[k]);
+        sendExamples(c, c->fd[0], c->ex[k], c->nex[k], d->nex);
+    }
+    else
+        c->nex[k] = recvExamples(c, c->fd[0], k);
+}
+
+void popSplit(cluster_t* c){
+    c->depth--;
+}
+
+/* The examples moved by the split of the current node */
+int splitExamples(cluster_t* c, int** ex){
+    *ex = c->ex[c->depth-1];
+    return c->nex[c->depth-1];
+}
@@ -0,0 +1,55 @@
+/***************************************************************************
+ * Author: Nikos Karampatziakis <nk@cs.cornell.edu>, Copyright (C) 2008    *
+ *                                                                         *
+ * Description: Declarations for growing trees with several processes that *
+ *              hold disjoint sets of features                             *
+ *                                                                         *
+ * License: See LICENSE file that comes with this distribution             *
+ ***************************************************************************/
+
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include "dataset.h"
+#include "tree.h"
+#include "forest.h"
+
+/* The parameters of the forest that the coordinator sends to every worker */
+typedef struct job_t{
+    int rank;
+    int nworkers;
+    int committee;
+    int maxdepth;
+    int ntrees;
+    int bootstrap;
+    int replace;
+    float factor;
+    float wneg;
+    float rate[2];
+    unsigned int seed;
+}job_t;
+
+typedef struct cluster_t{
+    int rank;      /* of this worker, -1 for the coordinator */
+    int nworkers;
+    int* fd;       /* coordinator: socket of each worker; worker: fd[0] is the coordinator */
+    int owner;     /* worker with the feature of the last split */
+    int** ex;      /* ex[k] = examples moved by the kth split on the path to the current node */
+    int* nex;      /* their number */
+    int* cap;      /* room in ex[k] */
+    int depth;     /* splits on the path to the current node */
+    int size;      /* room in ex, nex and cap */
+    unsigned char* bits; /* scratch space for the messages */
+    int nbits;
+}cluster_t;
+
+void startCluster(cluster_t* c, forest_t* f, dataset_t* d, char* workers);
+void joinCluster(cluster_t* c, forest_t* f, dataset_t* d, const char* address, const char* data, int pack);
+void stopCluster(cluster_t* c);
+void clusterRoot(cluster_t* c, node_t* root);
+split_t clusterSplit(tree_t* t, node_t* root, dataset_t* d);
+void pushSplit(tree_t* t, dataset_t* d, split_t* best);
+void popSplit(cluster_t* c);
+int splitExamples(cluster_t* c, int** ex);
+
+#endif /* CLUSTER_H */
@@ -0,0 +1,370 @@
+/***************************************************************************
+ * Author: Nikos Karampatziakis <nk@cs.cornell.edu>, Copyright (C) 2008    *
+ *                                                                         *
+ * Description: Compaction module. Rewrites a model with fewer trees and   *
+ *              nodes, changing its predictions by at most a tolerance.    *
+ *                                                                         *
+ * License: See LICENSE file that comes with this distribution             *
+ ***************************************************************************/
+
+#include "dataset.h"
+#include "tree.h"
+#include "forest.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+typedef struct shape_t{
+    unsigned int hash;
+    int tree;
+}shape_t;
+
+typedef struct spread_t{
+    float radius;
+    int tree;
+}spread_t;
+
+/* readForest stored the output of every leaf in its threshold, so the
+ * masses can go */
+void keepOutputs(node_t* t){
+    if(t->split >= 0){
+        keepOutputs(t->left);
+        keepOutputs(t->right);
+    }
+    else
+        t->split = OUTPUTLEAF;
+}
+
+/* Replace the subtree t by a leaf with output v */
+void makeLeaf(node_t* t, float v){
+    if(t->split >= 0){
+        freeTree(t->left);
+        freeTree(t->right);
+    }
+    t->split = OUTPUTLEAF;
+    t->threshold = v;
+    t->pos = t->neg = 0;
+    t->left = t->right = NULL;
+}
+
+/* Half the spread of the outputs below t, which is the largest change of
+ * any output if t becomes a leaf with their midpoint */
+float radius(node_t* t, float* mid){
+    float lo = FLT_MAX;
+    float hi = -FLT_MAX;
+    outputRange(t, BOOSTING, &lo, &hi);
+    *mid = 0.5f*(lo+hi);
+    return 0.5f*(hi-lo);
+}
+
+/* Replace every subtree whose outputs are within b of their midpoint by a
+ * leaf. With b=0 only the splits that make no difference go. */
+void collapse(node_t* t, float b){
+    float mid;
+    if(t->split < 0)
+        return;
+    if(radius(t, &mid) <= b){
+        makeLeaf(t, mid);
+        return;
+    }
+    collapse(t->left, b);
+    collapse(t->right, b);
+}
+
+/* Do a and b have the same splits, and the same outputs if outputs is set? */
+int sameTree(node_t* a, node_t* b, int outputs){
+    if(a->split != b->split)
+        return 0;
+    if(a->split < 0)
+        return !outputs || a->threshold == b->threshold;
+    return a->threshold == b->threshold && sameTree(a->left, b->left, outputs)
+        && sameTree(a->right, b->right, outputs);
+}
+
+/* A split whose two subtrees are the same has no effect */
+void dedupe(node_t* t){
+    node_t* l;
+    if(t->split < 0)
+        return;
+    dedupe(t->left);
+    dedupe(t->right);
+    if(sameTree(t->left, t->right, 1)){
+        l = t->left;
+        freeTree(t->right);
+        *t = *l;
+        free(l);
+    }
+}
+
+/* Hash of the splits of t, ignoring the outputs */
+unsigned int shapeHash(node_t* t){
+    unsigned int h,bits;
+    if(t->split < 0)
+        return 1;
+    memcpy(&bits, &t->threshold, sizeof(bits));
+    h = (unsigned int)t->split*2654435761u ^ bits*0x85ebca6bu;
+    h = h*31 + shapeHash(t->left);
+    return h*37 + shapeHash(t->right);
+}
+
+static int byHash(const void* a, const void* b){
+    const shape_t* x = a;
+    const shape_t* y = b;
+    if(x->hash != y->hash)
+        return x->hash < y->hash ? -1 : 1;
+    return x->tree - y->tree;
+}
+
+/* Add the outputs of b to those of a, which has the same splits */
+void addOutputs(node_t* a, node_t* b){
+    if(a->split < 0){
+        a->threshold += b->threshold;
+        return;
+    }
+    addOutputs(a->left, b->left);
+    addOutputs(a->right, b->right);
+}
+
+void scaleOutputs(node_t* t, float s){
+    if(t->split < 0){
+        t->threshold *= s;
+        return;
+    }
+    scaleOutputs(t->left, s);
+    scaleOutputs(t->right, s);
+}
+
+int countNodes(node_t* t){
+    if(t->split < 0)
+        return 1;
+    return 1 + countNodes(t->left) + countNodes(t->right);
+}
+
+static int byRadius(const void* a, const void* b){
+    float x = ((const spread_t*)a)->radius, y = ((const spread_t*)b)->radius;
+    return (x > y) - (x < y);
+}
+
+/* Trees that sum to the same outputs can be merged into one, since the
+ * prediction only depends on the sum. The first of them keeps its place.
+ * Identical subtrees of different trees are not shared: the model format
+ * has no way to refer to a node, so only whole trees are merged. */
+void mergeTrees(forest_t* f){
+    int i,j,k;
+    shape_t* s = malloc(f->ngrown*sizeof(shape_t));
+    for(i=0; i<f->ngrown; i++){
+        s[i].hash = shapeHash(f->tree[i]);
+        s[i].tree = i;
+    }
+    qsort(s, f->ngrown, sizeof(shape_t), byHash);
+    for(i=0; i<f->ngrown; i=j){
+        for(j=i+1; j<f->ngrown && s[j].hash == s[i].hash; j++){
+            for(k=i; k<j; k++){
+                if(f->tree[s[k].tree] && sameTree(f->tree[s[k].tree], f->tree[s[j].tree], 0)){
+                    addOutputs(f->tree[s[k].tree], f->tree[s[j].tree]);
+                    freeTree(f->tree[s[j].tree]);
+                    f->tree[s[j].tree] = NULL;
+                    break;
+                }
+            }
+        }
+    }
+    free(s);
+    for(i=0, j=0; i<f->ngrown; i++){
+        if(f->tree[i])
+            f->tree[j++] = f->tree[i];
+    }
+    f->ngrown = j;
+}
+
+/* Change the trees of f so that the average of their outputs, which is the
+ * prediction, moves by at most tol for any example. First the trees with the
+ * least spread become constants, then the rest of the budget is shared by
+ * the other trees to collapse their subtrees. Constant trees are summed and
+ * dropped if what is left of the budget covers their sum. Finally splits
+ * with the same subtrees go, trees with the same splits are merged and the
+ * outputs are scaled so that the average is over the trees that remain.
+ */
+void compactForest(forest_t* f, float tol){
+    int i,k,n,rest,bias;
+    double budget,used;
+    float mid,c;
+    spread_t* r;
+
+    n = f->ngrown;
+    budget = (double)tol*n;
+    used = 0;
+    for(i=0; i<n; i++)
+        keepOutputs(f->tree[i]);
+
+    r = malloc(n*sizeof(spread_t));
+    for(i=0; i<n; i++){
+        r[i].radius = radius(f->tree[i], &mid);
+        r[i].tree = i;
+    }
+    qsort(r, n, sizeof(spread_t), byRadius);
+    for(k=0; k<n && used + r[k].radius <= budget; k++){
+        radius(f->tree[r[k].tree], &mid);
+        makeLeaf(f->tree[r[k].tree], mid);
+        used += r[k].radius;
+    }
+    free(r);
+
+    c = 0;
+    bias = -1;
+    rest = 0;
+    for(i=0; i<n; i++){
+        if(f->tree[i]->split >= 0)
+            rest++;
+        else if(bias < 0){
+            bias = i;
+            c = f->tree[i]->threshold;
+        }
+        else{
+            c += f->tree[i]->threshold;
+            f->tree[i]->threshold = 0;
+        }
+    }
+    if(bias >= 0){
+        f->tree[bias]->threshold = c;
+        if(rest > 0 && used + fabsf(c) <= budget){
+            f->tree[bias]->threshold = 0;
+            used += fabsf(c);
+        }
+    }
+    for(i=0; i<n && rest > 0; i++){
+        if(f->tree[i]->split >= 0)
+            collapse(f->tree[i], (budget-used)/rest);
+    }
+    for(i=0; i<n; i++)
+        dedupe(f->tree[i]);
+    mergeTrees(f);
+
+    /* After mergeTrees there is at most one constant tree. If its output is
+     * 0 it adds nothing. */
+    for(i=0, k=0; i<f->ngrown; i++){
+        if(f->ngrown > 1 && f->tree[i]->split < 0 && f->tree[i]->threshold == 0)
+            freeTree(f->tree[i]);
+        else
+            f->tree[k++] = f->tree[i];
+    }
+    f->ngrown = k;
+    for(i=0; i<f->ngrown; i++)
+        scaleOutputs(f->tree[i], (float)f->ngrown/n);
+    f->compacted = 1;
+}
+
+long fileSize(const char* fname){
+    struct stat st;
+    if(stat(fname, &st) != 0)
+        return 0;
+    return st.st_size;
+}
+
+long forestNodes(forest_t* f){
+    int i;
+    long nodes = 0;
+    for(i=0; i<f->ngrown; i++)
+        nodes += countNodes(f->tree[i]);
+    return nodes;
+}
+
+int main(int argc, char* argv[]){
+    forest_t f,g;
+    forest_t* m[2];
+    FILE* fp;
+    float* example;
+    char* line=0;
+    size_t cap=0;
+    int target,n,i,j,option;
+    int changed=0;
+    float p[2];
+    double start;
+    double wall[2]={0,0};
+    long nodes[2]={0,0};
+    float delta=0;
+    float threshold;
+    float tol=0;
+    char* name[2];
+
+    const char* help="Usage: %s [options] model newmodel [data]\nWith data, the scoring speed and the predictions of both models are compared on it.\nAvailable options:\n\
+    -e <float>: largest change of the prediction for any example (default: 0 = same predictions)\n";
+
+    while((option=getopt(argc,argv,"e:"))!=EOF){
+        switch(option){
+            case 'e': tol=atof(optarg); break;
+            case '?': fprintf(stderr,help,argv[0]); exit(1); break;
+        }
+    }
+    if(tol < 0){
+        fprintf(stderr,"Invalid tolerance\n");
+        exit(1);
+    }
+    if(argc - optind != 2 && argc - optind != 3){
+        fprintf(stderr,help,argv[0]);
+        exit(1);
+    }
+    name[0] = argv[optind];
+    name[1] = argv[optind+1];
+    readForest(&f, name[0]);
+    if(f.ngrown == 0){
+        fprintf(stderr,"The model has no trees\n");
+        exit(1);
+    }
+    nodes[0] = forestNodes(&f);
+    printf("%9s  %6s  %8s  %10s\n","","trees","nodes","bytes");
+    printf("%9s  %6d  %8ld  %10ld\n","model",f.ngrown,nodes[0],fileSize(name[0]));
+    compactForest(&f, tol);
+    writeForest(&f, name[1]);
+    printf("%9s  %6d  %8ld  %10ld\n","compacted",f.ngrown,forestNodes(&f),fileSize(name[1]));
+    freeForest(&f);
+    if(argc - optind == 2)
+        return 0;
+
+    /* Score the data with the model and with what was written */
+    readForest(&f, name[0]);
+    readForest(&g, name[1]);
+    m[0] = &f;
+    m[1] = &g;
+    fp = openData(argv[optind+2]);
+    if(fp == NULL){
+        fprintf(stderr,"Could not open test data file\n");
+        exit(1);
+    }
+    threshold = f.committee == BOOSTING ? 0 : 0.5;
+    example = malloc(f.nfeat*sizeof(float));
+    nodes[0] = 0;
+    n = 0;
+    while(readExample(fp, &line, &cap, example, f.nfeat, f.featid, &target)){
+        /* Take turns at going first, so that neither model always finds
+         * the example in the cache */
+        for(j=0; j<2; j++){
+            i = (n+j)%2;
+            start = wallClock();
+            p[i] = classifyForest(m[i], example);
+            wall[i] += wallClock() - start;
+            nodes[i] += nodesVisited(m[i], example, m[i]->ngrown);
+        }
+        delta = fmaxf(delta, fabsf(p[1]-p[0]));
+        changed += (p[0] > threshold) != (p[1] > threshold);
+        n++;
+    }
+    closeData(fp);
+    if(n > 0){
+        printf("\n%9s  %10s  %10s\n","","nodes/ex","examples/s");
+        for(i=0; i<2; i++)
+            printf("%9s  %10.1f  %10.0f\n",i ? "compacted" : "model",(double)nodes[i]/n,wall[i] > 0 ? n/wall[i] : 0);
+        printf("\nLargest change of a prediction: %g (tolerance %g)\n",delta,tol);
+        printf("Decisions changed: %d of %d\n",changed,n);
+    }
+    free(example);
+    free(line);
+    freeForest(&f);
+    freeForest(&g);
+    return 0;
+}
@@ -10,16 +10,29 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "dataset.h"
+#include "stats.h"
 
-#define BUFSZ 4096
+/* Order of the pairs: by feature, then by value, then by example. 
+ * Breaking ties by example makes the order unique, which keeps the 
+ * example ids of a run of equal values increasing (see packData). */
+static int before(int f1, evpair_t* a1, int f2, evpair_t* a2){
+    if(f1 != f2)
+        return f1 < f2;
+    if(a1->value != a2->value)
+        return a1->value < a2->value;
+    return a1->example < a2->example;
+}
 
 void isort(evpair_t* a, int* f, int n){
     int i,j;
     float tv;
     int te;
     for(i=1; i<n; i++){
-        for(j=i; j>0 && (f[j-1] > f[j] || (f[j-1] == f[j] && a[j-1].value > a[j].value)); j--){
+        for(j=i; j>0 && before(f[j],&a[j],f[j-1],&a[j-1]); j--){
             te=f[j];         f[j]=f[j-1];                 f[j-1]=te;
             te=a[j].example; a[j].example=a[j-1].example; a[j-1].example=te;
             tv=a[j].value;   a[j].value=a[j-1].value;     a[j-1].value=tv;
@@ -40,8 +53,8 @@ void qsortlazy(evpair_t* a, int* f, int l, int u){
     i=l;
     j=u+1;
     while(1){
-        do i++; while (i<=u && (f[i] < te || (f[i]==te && a[i].value < tv)));
-        do j--; while (f[j] > te || (f[j]==te && a[j].value > tv));
+        do i++; while (i<=u && before(f[i],&a[i],f[l],&a[l]));
+        do j--; while (before(f[l],&a[l],f[j],&a[j]));
         if (i>j)
             break;
         se=f[i];         f[i]=f[j];                 f[j]=se;
@@ -60,153 +73,428 @@ void sort(evpair_t* a, int* f, int len){
     isort(a,f,len);
 }
 
-int getDimensions(FILE* fp, int* examples, int* totalfeatures){
-    char buf[BUFSZ];
-    int i,buflen,previous,total,max,len,example,inside;
+/* Parse the pairs of one line into em/fm and its label into target. 
+ * Returns the number of pairs or -1 if the line holds no example. */
+static int readPairs(char* line, int example, evpair_t* em, int* fm, int* target){
+    int i;
+    float val;
+    char* c;
+    char* v;
+    char* p;
 
-    previous=-1;
-    total=0;
-    max=0;
-    example=0;
-    inside=0;
-    rewind(fp);
-
-    *examples = 0;
-    *totalfeatures = 0;
-
-    while((buflen=fread(buf,sizeof(char),BUFSZ,fp))!=0){
-        for(i=0; i<buflen; i++,total++){
-            switch(buf[i]){
-                case ':':
-                    if(inside)
-                        continue;
-                    *totalfeatures += 1;
-                    break;
-                case '#':
-                    inside=1;
-                    break;
-                case '\n':
-                    if(example) *examples+=1;
-                    inside=0;
-                    example=0;
-                    len=total-previous;
-                    previous=total;
-                    if(max<len) max=len;
-                    break;
-                case '0':
-                case '1':
-                    if(inside)
-                        continue;
-                    example=1;
-                    break;
-                default:
-                    break;
-            }
-        }
+    /* remove comments */
+    c=strchr(line,'#');
+    if(c!=NULL)
+        *c = '\0';
+    c = strtok(line," \t\r\n");
+    if(c==NULL)
+        /* The line was a comment */
+        return -1;
+    *target = strtol(c,&p,10) <=0 ? 0 : 1;
+    i=0;
+    while((c = strtok(NULL,":"))){
+        v = strtok(NULL," \t\r\n");
+        if(!v)
+            break;
+        val = strtod(v,&p);
+        /* We don't want to store any zeros even if they appear explicitly in the input. 
+         * Storing zero values will bite us later becaus of counting tricks etc. */
+        if(val==0)
+            continue;
+        fm[i] = strtol(c,&p,10);
+        em[i].example=example;
+        em[i].value=val;
+        i+=1;
+    }
+    return i;
+}
+
+int parseExample(char* line, float* example, int nfeat, const int* featid, int* target){
+    int offset,feat,len;
+    float val;
+    char* comment;
+
+    memset(example,0,nfeat*sizeof(float));
+    /* remove comments */
+    comment=strchr(line,'#');
+    if(comment!=NULL)
+        *comment = '\0';
+    if(sscanf(line,"%d%n",target,&len)==EOF)
+        /* The line was a comment */
+        return 0;
+    *target = *target <=0 ? 0 : 1;
+    for(offset=len; sscanf(line+offset,"%d:%f%n",&feat,&val,&len)>=2; offset+=len){
+        if (featid)
+            feat = findFeature(featid, nfeat, feat);
+        /* Throw away features that do not exist in the tree */
+        if (feat >= 0 && feat < nfeat)
+            example[feat]=val;
     }
+    return 1;
+}
 
-    rewind(fp);
-    return max+4; /* Just in case I was sloppy */
+/* Read the next example of fp. line and cap are as in getline. */
+int readExample(FILE* fp, char** line, size_t* cap, float* example, int nfeat, const int* featid, int* target){
+    while(getline(line,cap,fp)!=-1){
+        if(parseExample(*line,example,nfeat,featid,target))
+            return 1;
+    }
+    return 0;
 }
 
-int readExamples(FILE* fp, int maxline, evpair_t* em, int* fm, int* trg){
-    int i,target,example;
+/* Same as readExample, but example must hold the previous example read
+ * this way (or be all zeros): only its nonzero features, which are in
+ * active[0..*nactive-1], are cleared instead of the whole vector. The
+ * nonzero features of the new example are left in active, which needs room
+ * for nfeat of them. */
+int readSparseExample(FILE* fp, char** line, size_t* cap, float* example, int nfeat, const int* featid, int* target, int* active, int* nactive){
+    int i,feat;
     float val;
-    char* line;
     char* c;
-    char* v;
     char* p;
 
-    line=malloc(maxline*sizeof(char));
-    rewind(fp);
-    example=0;
-    i=0;
-    while(fgets(line,maxline,fp)!=NULL){
-        /* remove comments */
-        c=strchr(line,'#');
+    while(getline(line,cap,fp)!=-1){
+        for(i=0; i<*nactive; i++)
+            example[active[i]] = 0;
+        *nactive = 0;
+        c=strchr(*line,'#');
         if(c!=NULL)
             *c = '\0';
-        c = strtok(line," \t");
-        if(c==NULL)
-            /* The line was a comment */
-            continue;
-        target = strtol(c,&p,10);
-        trg[example] = target <=0 ? 0 : 1;
-        while((c = strtok(NULL,":"))){
-            v = strtok(NULL," \t");
-            if(!v)
+        *target = strtol(*line,&p,10);
+        if(p == *line){
+            /* Only blanks: the line was a comment */
+            if((*line)[strspn(*line," \t\n\r\v\f")] == '\0')
+                continue;
+            *target = 0;
+            return 1;
+        }
+        *target = *target <=0 ? 0 : 1;
+        for(c=p; ; c=p){
+            feat = strtol(c,&p,10);
+            if(p == c || *p != ':')
+                break;
+            c = p+1;
+            val = strtof(c,&p);
+            if(p == c)
                 break;
-            val = strtod(v,&p);
-            /* We don't want to store any zeros even if they appear explicitly in the input. 
-             * Storing zero values will bite us later becaus of counting tricks etc. */
-            if(val==0)
+            if (featid)
+                feat = findFeature(featid, nfeat, feat);
+            if (feat < 0 || feat >= nfeat)
                 continue;
-            fm[i] = strtol(c,&p,10);
-            em[i].example=example;
-            em[i].value=val;
-            i+=1;
+            if(example[feat] == 0 && val != 0)
+                active[(*nactive)++] = feat;
+            example[feat] = val;
         }
-        example+=1;
+        return 1;
     }
-    free(line);
-    return i;
+    return 0;
 }
 
-int readExample(FILE* fp, int maxline, float* example, int nfeat, int* target){
-    int offset,feat,len;
-    float val;
-    char* line;
-    char* comment;
+/* Open a data file for reading, "-" is the standard input. The data is 
+ * read once from start to end, so it may also be a pipe. */
+FILE* openData(const char* name){
+    if(strcmp(name,"-")==0)
+        return stdin;
+    return fopen(name,"r");
+}
 
-    line=malloc(maxline*sizeof(char));
-    memset(example,0,nfeat*sizeof(float));
+void closeData(FILE* fp){
+    if(fp!=stdin)
+        fclose(fp);
+}
 
-    while(fgets(line,maxline,fp)!=NULL){
-        /* remove comments */
-        comment=strchr(line,'#');
-        if(comment!=NULL)
-            *comment = '\0';
-        if(sscanf(line,"%d%n",target,&len)==EOF)
-            /* The line was a comment */
+/* Store feature i as a dense_t if most examples have it and it takes
+ * few distinct values, otherwise return NULL. */
+static dense_t* denseFeature(const evpair_t* b, int size, int nex){
+    dense_t* dn;
+    int j,h,n;
+
+    if(2*size<=nex)
+        return NULL;
+    n=size<nex;
+    for(j=0; j<size; j++){
+        if(j==0 || b[j].value!=b[j-1].value)
+            n++;
+    }
+    if(n>MAXBINS)
+        return NULL;
+    dn=malloc(sizeof(dense_t));
+    dn->bin=malloc(nex);
+    dn->nbins=0;
+    dn->zero=-1;
+    for(j=0; j<size; j++){
+        if(j>0 && b[j].value==b[j-1].value)
             continue;
-        *target = *target <=0 ? 0 : 1;
-        for(offset=len; sscanf(line+offset,"%d:%f%n",&feat,&val,&len)>=2; offset+=len){
-            /* Throw away features that do not exist in the tree */
-            if (feat < nfeat)
-                example[feat]=val;
+        if(dn->zero<0 && size<nex && b[j].value>0){
+            dn->zero=dn->nbins;
+            dn->value[dn->nbins++]=0;
         }
-        free(line);
-        return 1;
+        dn->value[dn->nbins++]=b[j].value;
     }
-    free(line);
-    return 0;
+    if(dn->zero<0 && size<nex){
+        dn->zero=dn->nbins;
+        dn->value[dn->nbins++]=0;
+    }
+    /* The examples that are not in b have the value 0 */
+    if(dn->zero>=0)
+        memset(dn->bin,dn->zero,nex);
+    for(j=0, h=-1; j<size; j++){
+        if(j==0 || b[j].value!=b[j-1].value)
+            h+=1+(h+1==dn->zero);
+        dn->bin[b[j].example]=h;
+    }
+    return dn;
+}
+
+/* Move the features that are better scanned example by example out of 
+ * the lists of pairs (see dense_t) and give back the room they took. */
+static void makeDense(dataset_t* d){
+    int i,sum;
+
+    d->dense=malloc(d->nfeat*sizeof(dense_t*));
+    sum=0;
+    for(i=0; i<d->nfeat; i++){
+        d->dense[i]=denseFeature(d->feature[i],d->size[i],d->nex);
+        if(d->dense[i])
+            continue;
+        memmove(d->pairs+sum,d->feature[i],d->size[i]*sizeof(evpair_t));
+        sum+=d->size[i];
+    }
+    d->pairs=realloc(d->pairs,(sum>0 ? sum : 1)*sizeof(evpair_t));
+    sum=0;
+    for(i=0; i<d->nfeat; i++){
+        d->feature[i]=d->dense[i] ? NULL : d->pairs+sum;
+        if(!d->dense[i])
+            sum+=d->size[i];
+    }
+}
+
+/* Keep the pairs em/fm[0..n-1] of the features whose id is shard modulo
+ * nshards and return their number */
+static int keepShard(evpair_t* em, int* fm, int n, int nshards, int shard){
+    int i,k;
+    for(i=0, k=0; i<n; i++){
+        if((unsigned int)fm[i]%nshards != (unsigned int)shard)
+            continue;
+        em[k]=em[i];
+        fm[k]=fm[i];
+        k++;
+    }
+    return k;
+}
+
+/* The rows read so far by loadRows, to find the copies of an example */
+typedef struct rows_t{
+    int* start;         /* first pair of each row in em/fm */
+    int* len;           /* number of its pairs */
+    unsigned int* hash;
+    int* slot;          /* row+1 in each slot of the hash table, 0 if empty */
+    int nslots;         /* a power of 2 */
+}rows_t;
+
+static unsigned int hashRow(const evpair_t* em, const int* fm, int n, int target){
+    unsigned int h=2166136261u^target,bits;
+    int i;
+    for(i=0; i<n; i++){
+        memcpy(&bits,&em[i].value,sizeof(bits));
+        h=(h^(unsigned int)fm[i])*16777619u;
+        h=(h^bits)*16777619u;
+    }
+    return h;
+}
+
+/* Put the pairs of one example in the order of their features, which they
+ * usually are in already */
+static void sortRow(evpair_t* em, int* fm, int n){
+    int i,j,tf;
+    evpair_t te;
+    for(i=1; i<n; i++){
+        for(j=i; j>0 && fm[j]<fm[j-1]; j--){
+            tf=fm[j]; fm[j]=fm[j-1]; fm[j-1]=tf;
+            te=em[j]; em[j]=em[j-1]; em[j-1]=te;
+        }
+    }
+}
+
+static void insertRow(rows_t* u, int row){
+    int k;
+    for(k=u->hash[row]&(u->nslots-1); u->slot[k]; k=(k+1)&(u->nslots-1))
+        ;
+    u->slot[k]=row+1;
+}
+
+/* The row that is a copy of the example in em/fm[total..total+n-1] with
+ * this target, or -1 after it is added as row nrows. The arrays of u have
+ * room for nrows+1 rows. */
+static int findRow(rows_t* u, const evpair_t* em, const int* fm, int total, int n, const int* target, int nrows){
+    unsigned int h=hashRow(em+total,fm+total,n,target[nrows]);
+    int i,k,r;
+    for(k=h&(u->nslots-1); u->slot[k]; k=(k+1)&(u->nslots-1)){
+        r=u->slot[k]-1;
+        if(u->hash[r]!=h || u->len[r]!=n || target[r]!=target[nrows])
+            continue;
+        for(i=0; i<n; i++){
+            if(fm[u->start[r]+i]!=fm[total+i] || em[u->start[r]+i].value!=em[total+i].value)
+                break;
+        }
+        if(i==n)
+            return r;
+    }
+    u->start[nrows]=total;
+    u->len[nrows]=n;
+    u->hash[nrows]=h;
+    if(2*(nrows+1)>u->nslots){
+        u->nslots*=2;
+        free(u->slot);
+        u->slot=calloc(u->nslots,sizeof(int));
+        for(r=0; r<nrows; r++)
+            insertRow(u,r);
+    }
+    insertRow(u,nrows);
+    return -1;
 }
 
 void loadData(const char* name, dataset_t* d){
+    loadRows(name,d,1,0,0);
+}
+
+/* Same as loadData but only the features whose id is shard modulo nshards
+ * are kept. All the examples are, with their labels. */
+void loadShard(const char* name, dataset_t* d, int nshards, int shard){
+    loadRows(name,d,nshards,shard,0);
+}
+
+/* Same as loadData but the copies of an example with the same label are
+ * one row, and d->count has the number of copies of every row */
+void loadUniqueData(const char* name, dataset_t* d){
+    loadRows(name,d,1,0,1);
+}
+
+/* The features of d are numbered 0..nfeat-1 in the order of their ids in
+ * featid. Those ids are kept only if some are missing: ids 0..max are used
+ * as they are, and so are ids 1..max, which are the usual ones since
+ * SVM-light numbers features from 1, with an empty feature 0 before them.
+ */
+static void plainIds(dataset_t* d){
+    int n=d->nfeat;
+    if(d->featid==NULL || n==0)
+        return;
+    if(d->featid[n-1]==n-1){
+        free(d->featid);
+        d->featid=NULL;
+    }
+    else if(d->featid[n-1]==n && d->featid[0]==1)
+        alignData(d,NULL,n+1);
+}
+
+void loadRows(const char* name, dataset_t* d, int nshards, int shard, int unique){
     FILE* fp;
-    int total,i,maxline,sum;
+    int total,i,j,n,r,sum,cap,size;
     evpair_t* em;
     int* fm;
+    char* line=NULL;
+    size_t linecap=0;
+    ssize_t len;
+    rows_t u;
 
-    fp=fopen(name,"r");
+    fp=openData(name);
     if(fp==NULL){
         printf("Could not open file %s\n",name);
         exit(1);
     }
-    maxline=getDimensions(fp, &d->nex, &total);
 
-    d->target=malloc(d->nex*sizeof(int));
+    /* The buffers grow as the examples are read */
+    size=1024;
+    cap=1<<16;
+    d->target=malloc(size*sizeof(int));
+    d->count=NULL;
+    memset(&u,0,sizeof(u));
+    if(unique){
+        d->count=malloc(size*sizeof(int));
+        u.start=malloc(size*sizeof(int));
+        u.len=malloc(size*sizeof(int));
+        u.hash=malloc(size*sizeof(unsigned int));
+        u.nslots=2*size;
+        u.slot=calloc(u.nslots,sizeof(int));
+    }
+    em=malloc(cap*sizeof(evpair_t));
+    fm=malloc(cap*sizeof(int));
+    d->nex=0;
+    total=0;
+    startPhase(PARSE);
+    while((len=getline(&line,&linecap,fp))!=-1){
+        /* A line has fewer pairs than characters */
+        while(total+len>cap){
+            cap*=2;
+            em=realloc(em,cap*sizeof(evpair_t));
+            fm=realloc(fm,cap*sizeof(int));
+        }
+        if(d->nex==size){
+            size*=2;
+            d->target=realloc(d->target,size*sizeof(int));
+            if(unique){
+                d->count=realloc(d->count,size*sizeof(int));
+                u.start=realloc(u.start,size*sizeof(int));
+                u.len=realloc(u.len,size*sizeof(int));
+                u.hash=realloc(u.hash,size*sizeof(unsigned int));
+            }
+        }
+        n=readPairs(line,d->nex,em+total,fm+total,&d->target[d->nex]);
+        if(n<0)
+            continue;
+        if(unique){
+            sortRow(em+total,fm+total,n);
+            r=findRow(&u,em,fm,total,n,d->target,d->nex);
+            if(r>=0){
+                d->count[r]+=1;
+                continue;
+            }
+            d->count[d->nex]=1;
+        }
+        if(nshards>1)
+            n=keepShard(em+total,fm+total,n,nshards,shard);
+        total+=n;
+        d->nex+=1;
+    }
+    free(line);
+    closeData(fp);
+    free(u.start);
+    free(u.len);
+    free(u.hash);
+    free(u.slot);
+    stopPhase(PARSE);
+
     d->oobvotes=calloc(d->nex,sizeof(int));
     d->weight=malloc(d->nex*sizeof(float));
+    d->use=NULL;
+    d->packed=NULL;
+    d->bytes=NULL;
+    d->mapsize=0;
 
-    em=malloc(total*sizeof(evpair_t));
-    fm=malloc(total*sizeof(int));
-
-    total=readExamples(fp, maxline, em, fm, d->target);
+    startPhase(SORT);
     sort(em,fm,total);
+    stopPhase(SORT);
+    startPhase(INDEX);
 
-    /* This is because the array of features is starting from 0 */
-    d->nfeat=fm[total-1]+1;
+    /* Renumber the features that appear in the data as 0..nfeat-1 so that
+     * nothing is allocated or scanned for ids that never occur. featid 
+     * maps back to the original ids unless no id was missing (see plainIds). */
+    d->nfeat=0;
+    for(i=0; i<total; i++){
+        if(i==0 || fm[i]!=fm[i-1])
+            d->nfeat+=1;
+    }
+    d->featid=NULL;
+    if(total>0 && d->nfeat==fm[total-1] && fm[0]==1)
+        d->nfeat+=1;
+    else if(total>0 && d->nfeat!=fm[total-1]+1){
+        d->featid=malloc(d->nfeat*sizeof(int));
+        for(i=0, j=-1; i<total; i++){
+            if(j<0 || fm[i]!=d->featid[j])
+                d->featid[++j]=fm[i];
+            fm[i]=j;
+        }
+    }
 
     d->size=calloc(d->nfeat,sizeof(int));
     d->cont=calloc(d->nfeat,sizeof(int));
@@ -219,6 +507,7 @@ void loadData(const char* name, dataset_t* d){
     free(fm);
     
     d->feature=malloc(d->nfeat*sizeof(evpair_t*));
+    d->pairs=em;
     d->feature[0]=em;
 
     sum=0;
@@ -226,15 +515,1345 @@ void loadData(const char* name, dataset_t* d){
         sum+=d->size[i-1];
         d->feature[i]=d->feature[0]+sum;
     }
-    fclose(fp);
+    makeDense(d);
+    stopPhase(INDEX);
+}
+
+/* Runs merged at once by loadDataOnDisk */
+#define MAXFANIN 256
+
+/* A pair of a run together with its feature, as it is stored on disk */
+typedef struct record_t{
+    int feature;
+    evpair_t pair;
+}record_t;
+
+/* A sorted run of pairs on disk, see loadDataOnDisk. All the runs of a
+ * pass are in one file, so only two files are open however many they are. */
+typedef struct run_t{
+    int fd;       /* the file that holds the run */
+    off_t pos;    /* offset of the records not yet read */
+    off_t end;    /* offset where the run ends */
+    record_t* buf; /* records read ahead, while the run is being merged */
+    int next;     /* the next record of buf */
+    int have;     /* records in buf */
+    int cap;      /* room in buf */
+    int feature;  /* the pair at the head of the run */
+    evpair_t pair;
+}run_t;
+
+static int nextPair(run_t* r){
+    ssize_t n;
+    if(r->next==r->have){
+        if(r->pos>=r->end){
+            free(r->buf);
+            r->buf=NULL;
+            return 0;
+        }
+        n=(r->end-r->pos)/sizeof(record_t);
+        if(n>r->cap)
+            n=r->cap;
+        if(pread(r->fd,r->buf,n*sizeof(record_t),r->pos)!=n*(ssize_t)sizeof(record_t)){
+            fprintf(stderr,"Could not read a temporary file\n");
+            exit(1);
+        }
+        r->pos+=n*sizeof(record_t);
+        r->have=n;
+        r->next=0;
+    }
+    r->feature=r->buf[r->next].feature;
+    r->pair=r->buf[r->next].pair;
+    r->next+=1;
+    return 1;
+}
+
+/* An anonymous file in dir. It is gone once it is closed and unmapped. */
+static FILE* scratchFile(const char* dir){
+    char name[4096];
+    FILE* fp=NULL;
+    int fd=-1;
+    if(snprintf(name,sizeof(name),"%s/festXXXXXX",dir)<(int)sizeof(name))
+        fd=mkstemp(name);
+    if(fd>=0){
+        unlink(name);
+        fp=fdopen(fd,"w+");
+    }
+    if(fp==NULL){
+        fprintf(stderr,"Could not create a temporary file in %s\n",dir);
+        exit(1);
+    }
+    return fp;
+}
+
+/* Append the record of a pair to the runs in fp */
+static void writeRecord(FILE* fp, int feature, const evpair_t* pair, const char* dir){
+    record_t rec;
+    rec.feature=feature;
+    rec.pair=*pair;
+    if(fwrite(&rec,sizeof(record_t),1,fp)!=1){
+        fprintf(stderr,"Could not write to a temporary file in %s\n",dir);
+        exit(1);
+    }
+}
+
+/* Sort the pairs em/fm[0..n-1] and append them to fp as a new run */
+static void writeRun(evpair_t* em, int* fm, int n, const char* dir, FILE* fp, run_t* r){
+    int i;
+    startPhase(SORT);
+    sort(em,fm,n);
+    r->pos=ftello(fp);
+    for(i=0; i<n; i++)
+        writeRecord(fp,fm[i],&em[i],dir);
+    r->end=ftello(fp);
+    stopPhase(SORT);
+}
+
+/* Restore the order of a heap of runs whose root may be out of place */
+static void siftDown(run_t* run, int* heap, int n){
+    int i=0,c,t;
+    while((c=2*i+1)<n){
+        if(c+1<n && before(run[heap[c+1]].feature,&run[heap[c+1]].pair,run[heap[c]].feature,&run[heap[c]].pair))
+            c++;
+        if(!before(run[heap[c]].feature,&run[heap[c]].pair,run[heap[i]].feature,&run[heap[i]].pair))
+            break;
+        t=heap[i]; heap[i]=heap[c]; heap[c]=t;
+        i=c;
+    }
+}
+
+/* Put the runs run[0..n-1] of the file fd that are not empty in a heap,
+ * each reading ahead cap records. Returns the size of the heap. */
+static int heapRuns(run_t* run, int n, int fd, int cap, int* heap){
+    int i,k,t,nheap=0;
+    for(i=0; i<n; i++){
+        run[i].fd=fd;
+        run[i].buf=malloc(cap*sizeof(record_t));
+        run[i].cap=cap;
+        run[i].next=run[i].have=0;
+        if(!nextPair(&run[i]))
+            continue;
+        heap[nheap++]=i;
+        for(k=nheap-1; k>0 && before(run[heap[k]].feature,&run[heap[k]].pair,run[heap[(k-1)/2]].feature,&run[heap[(k-1)/2]].pair); k=(k-1)/2){
+            t=heap[k]; heap[k]=heap[(k-1)/2]; heap[(k-1)/2]=t;
+        }
+    }
+    return nheap;
+}
+
+/* Merge the runs run[0..n-1] of the file fd into one run appended to out */
+static void mergeRuns(run_t* run, int n, int fd, int cap, FILE* out, const char* dir, run_t* merged){
+    int heap[MAXFANIN];
+    int nheap=heapRuns(run,n,fd,cap,heap);
+    run_t* r;
+    merged->pos=ftello(out);
+    while(nheap>0){
+        r=&run[heap[0]];
+        writeRecord(out,r->feature,&r->pair,dir);
+        if(!nextPair(r))
+            heap[0]=heap[--nheap];
+        siftDown(run,heap,nheap);
+    }
+    merged->end=ftello(out);
+}
+
+/* Same as loadData for data that does not fit in memory. The pairs are
+ * sorted in runs of at most memory bytes, which are merged into a file in
+ * dir that is mapped to memory, so only the columns in use need to be in
+ * RAM. The runs are merged MAXFANIN at a time, in as many passes as it
+ * takes. The result is the same as with loadData, except that no feature
+ * is made dense.
+ */
+void loadDataOnDisk(const char* name, dataset_t* d, size_t memory, const char* dir){
+    FILE* fp;
+    FILE* out;
+    FILE* runs;
+    char* line=NULL;
+    size_t linecap=0;
+    ssize_t len;
+    evpair_t* em;
+    int* fm;
+    int* heap;
+    run_t* run;
+    run_t* r;
+    run_t merged;
+    int i,k,nruns,nheap,size,ntarget,ahead;
+    size_t n,cap;
+    long npairs;
+
+    fp=openData(name);
+    if(fp==NULL){
+        printf("Could not open file %s\n",name);
+        exit(1);
+    }
+
+    /* The pairs of a run are indexed with ints like those of a column */
+    cap=memory/(sizeof(evpair_t)+sizeof(int));
+    if(cap<1024)
+        cap=1024;
+    if(cap>INT_MAX/2)
+        cap=INT_MAX/2;
+    em=malloc(cap*sizeof(evpair_t));
+    fm=malloc(cap*sizeof(int));
+    ntarget=1024;
+    d->target=malloc(ntarget*sizeof(int));
+    size=16;
+    run=malloc(size*sizeof(run_t));
+    runs=scratchFile(dir);
+    nruns=0;
+    n=0;
+    d->nex=0;
+    startPhase(PARSE);
+    while((len=getline(&line,&linecap,fp))!=-1){
+        /* A line has fewer pairs than characters. Start a new run if this 
+         * line might not fit, or make room if it is longer than a run. */
+        if(n+len>cap && n>0){
+            if(nruns==size){
+                size*=2;
+                run=realloc(run,size*sizeof(run_t));
+            }
+            stopPhase(PARSE);
+            writeRun(em,fm,n,dir,runs,&run[nruns++]);
+            startPhase(PARSE);
+            n=0;
+        }
+        if((size_t)len>cap){
+            cap=len;
+            em=realloc(em,cap*sizeof(evpair_t));
+            fm=realloc(fm,cap*sizeof(int));
+        }
+        if(d->nex==ntarget){
+            ntarget*=2;
+            d->target=realloc(d->target,ntarget*sizeof(int));
+        }
+        k=readPairs(line,d->nex,em+n,fm+n,&d->target[d->nex]);
+        if(k<0)
+            continue;
+        n+=k;
+        d->nex+=1;
+    }
+    closeData(fp);
+    free(line);
+    stopPhase(PARSE);
+    if(n>0){
+        if(nruns==size){
+            size*=2;
+            run=realloc(run,size*sizeof(run_t));
+        }
+        writeRun(em,fm,n,dir,runs,&run[nruns++]);
+    }
+    d->oobvotes=calloc(d->nex,sizeof(int));
+    d->weight=malloc(d->nex*sizeof(float));
+    d->use=NULL;
+    d->count=NULL;
+    d->packed=NULL;
+    d->bytes=NULL;
+    free(em);
+    free(fm);
+
+
+    /* The runs that are merged together share the memory of a run */
+    ahead=memory/(MAXFANIN*sizeof(record_t));
+    if(ahead<64)
+        ahead=64;
+    if(ahead>65536)
+        ahead=65536;
+    /* Merge groups of runs until one pass can merge them all */
+    startPhase(SORT);
+    fflush(runs);
+    while(nruns>MAXFANIN){
+        fp=scratchFile(dir);
+        for(i=0, k=0; i<nruns; i+=MAXFANIN, k++){
+            mergeRuns(run+i, nruns-i<MAXFANIN ? nruns-i : MAXFANIN, fileno(runs), ahead, fp, dir, &merged);
+            run[k]=merged;
+        }
+        nruns=k;
+        fflush(fp);
+        fclose(runs);
+        runs=fp;
+    }
+    /* Merge the runs into one file, finding the features on the way */
+    heap=malloc((nruns+1)*sizeof(int));
+    nheap=heapRuns(run,nruns,fileno(runs),ahead,heap);
+    out=scratchFile(dir);
+    size=1024;
+    d->featid=malloc(size*sizeof(int));
+    d->size=malloc(size*sizeof(int));
+    d->cont=malloc(size*sizeof(int));
+    d->nfeat=0;
+    npairs=0;
+    while(nheap>0){
+        r=&run[heap[0]];
+        if(d->nfeat==0 || r->feature!=d->featid[d->nfeat-1]){
+            if(d->nfeat==size){
+                size*=2;
+                d->featid=realloc(d->featid,size*sizeof(int));
+                d->size=realloc(d->size,size*sizeof(int));
+                d->cont=realloc(d->cont,size*sizeof(int));
+            }
+            d->featid[d->nfeat]=r->feature;
+            d->size[d->nfeat]=0;
+            d->cont[d->nfeat]=0;
+            d->nfeat+=1;
+        }
+        d->size[d->nfeat-1]+=1;
+        if(r->pair.value!=1)
+            d->cont[d->nfeat-1]=1;
+        if(fwrite(&r->pair,sizeof(evpair_t),1,out)!=1){
+            fprintf(stderr,"Could not write to a temporary file in %s\n",dir);
+            exit(1);
+        }
+        npairs+=1;
+        if(!nextPair(r))
+            heap[0]=heap[--nheap];
+        siftDown(run,heap,nheap);
+    }
+    fclose(runs);
+    free(heap);
+    free(run);
+
+    stopPhase(SORT);
+
+    startPhase(INDEX);
+    fflush(out);
+    d->mapsize=npairs*sizeof(evpair_t);
+    if(d->mapsize>0){
+        d->pairs=mmap(NULL,d->mapsize,PROT_READ,MAP_SHARED,fileno(out),0);
+        if(d->pairs==MAP_FAILED){
+            fprintf(stderr,"Could not map the sorted data\n");
+            exit(1);
+        }
+    }
+    else
+        d->pairs=malloc(sizeof(evpair_t));
+    fclose(out);
+
+    d->feature=malloc(d->nfeat*sizeof(evpair_t*));
+    d->dense=calloc(d->nfeat,sizeof(dense_t*));
+    npairs=0;
+    for(i=0; i<d->nfeat; i++){
+        d->feature[i]=d->pairs+npairs;
+        npairs+=d->size[i];
+    }
+    plainIds(d);
+    stopPhase(INDEX);
+}
+
+static void freePairs(dataset_t* d){
+    if(d->mapsize)
+        munmap(d->pairs,d->mapsize);
+    else
+        free(d->pairs);
+    d->pairs=NULL;
+    d->mapsize=0;
 }
 
 void freeData(dataset_t* d){  
+    int i;
     free(d->size);
     free(d->cont);
     free(d->target);
     free(d->oobvotes);
     free(d->weight);
-    free(d->feature[0]);
+    freePairs(d);
     free(d->feature);
+    free(d->packed);
+    free(d->bytes);
+    for(i=0; i<d->nfeat; i++){
+        if(d->dense[i]){
+            free(d->dense[i]->bin);
+            free(d->dense[i]);
+        }
+    }
+    free(d->dense);
+    free(d->featid);
+    free(d->count);
+}
+
+/* Write x in 7 bit groups, least significant first, and return the number
+ * of bytes used. Nothing is written if p is NULL. */
+static int putVarint(unsigned char* p, unsigned long long x){
+    int n=0;
+    while(x>=128){
+        if(p)
+            p[n]=(x&127)|128;
+        n++;
+        x>>=7;
+    }
+    if(p)
+        p[n]=x;
+    return n+1;
+}
+
+static unsigned long long getVarint(const unsigned char** p){
+    unsigned long long x=0;
+    int shift=0;
+    if(**p<128)
+        return *(*p)++;
+    while(**p&128){
+        x|=(unsigned long long)(*(*p)++&127)<<shift;
+        shift+=7;
+    }
+    x|=(unsigned long long)(*(*p)++)<<shift;
+    return x;
+}
+
+/* Encodings of a compressed column. A column starts with a varint that is
+ * four times the length of the rest plus its encoding. */
+enum{ PACKRUNS, PACKFIXED, PACKRAW };
+
+/* The bits of v as an unsigned int that increases with v, so that the
+ * increasing values of a column are stored as small differences */
+static unsigned int orderedBits(float v){
+    unsigned int u;
+    memcpy(&u,&v,sizeof(float));
+    return u&0x80000000u ? ~u : u|0x80000000u;
+}
+
+static float orderedFloat(unsigned int u){
+    float v;
+    u=u&0x80000000u ? u&0x7fffffffu : ~u;
+    memcpy(&v,&u,sizeof(float));
+    return v;
+}
+
+/* The number of bits needed to store x, at least one */
+static int bitsFor(unsigned int x){
+    int n;
+    for(n=1; n<32 && x>>n; n++)
+        ;
+    return n;
+}
+
+/* A writer of numbers of a fixed number of bits packed in successive
+ * bytes. Without bytes it only counts them. */
+typedef struct bits_t{
+    unsigned char* p;
+    size_t len;
+    unsigned long long acc;
+    int have;
+}bits_t;
+
+static void putBits(bits_t* w, unsigned int x, int nbits){
+    w->acc|=(unsigned long long)x<<w->have;
+    for(w->have+=nbits; w->have>=8; w->have-=8, w->acc>>=8){
+        if(w->p)
+            w->p[w->len]=w->acc;
+        w->len++;
+    }
+}
+
+/* Write the last bits and return the number of bytes used */
+static size_t flushBits(bits_t* w){
+    if(w->have>0){
+        if(w->p)
+            w->p[w->len]=w->acc;
+        w->len++;
+    }
+    w->acc=0;
+    w->have=0;
+    return w->len;
+}
+
+/* A sequence of runs of pairs with the same value. A run is stored as the
+ * number of pairs, the value (only if the feature is continuous, otherwise
+ * it is 1) as the difference from the value of the previous run (see
+ * orderedBits), the first example id and the differences between the
+ * following ids, which are increasing within a run, in as many bits as the
+ * largest of them needs. Returns the number of bytes used, nothing is
+ * written if p is NULL. */
+static size_t packRuns(const evpair_t* b, int size, int cont, unsigned char* p){
+    bits_t w={NULL,0,0,0};
+    int i,j,k,nbits;
+    unsigned int last=0;
+    w.p=p;
+    for(i=0; i<size; i=j){
+        for(j=i+1; j<size && b[j].value==b[i].value; j++)
+            ;
+        w.len+=putVarint(p ? p+w.len : NULL, j-i);
+        if(cont){
+            w.len+=putVarint(p ? p+w.len : NULL, orderedBits(b[i].value)-last);
+            last=orderedBits(b[i].value);
+        }
+        w.len+=putVarint(p ? p+w.len : NULL, b[i].example);
+        if(j-i==1)
+            continue;
+        for(nbits=1, k=i+1; k<j; k++){
+            if(bitsFor(b[k].example-b[k-1].example)>nbits)
+                nbits=bitsFor(b[k].example-b[k-1].example);
+        }
+        if(p)
+            p[w.len]=nbits;
+        w.len+=1;
+        for(k=i+1; k<j; k++)
+            putBits(&w,b[k].example-b[k-1].example,nbits);
+        flushBits(&w);
+    }
+    return w.len;
+}
+
+static void unpackRuns(const unsigned char* p, int size, int cont, evpair_t* buf){
+    const unsigned char* end;
+    int j,k,n,ex,have,nbits;
+    unsigned int mask,last=0;
+    unsigned long long acc;
+    float value=1;
+    for(j=0; j<size; j+=n){
+        n=getVarint(&p);
+        if(cont){
+            last+=getVarint(&p);
+            value=orderedFloat(last);
+        }
+        ex=getVarint(&p);
+        buf[j].example=ex;
+        buf[j].value=value;
+        if(n==1)
+            continue;
+        nbits=*p++;
+        mask=nbits<32 ? (1u<<nbits)-1 : ~0u;
+        end=p+((size_t)(n-1)*nbits+7)/8;
+        for(acc=0, have=0, k=j+1; k<j+n; k++){
+            /* Take as many bytes as fit, so that this is rarely needed */
+            if(have<nbits){
+                for(; have<=56 && p<end; have+=8)
+                    acc|=(unsigned long long)*p++<<have;
+            }
+            ex+=acc&mask;
+            acc>>=nbits;
+            have-=nbits;
+            buf[k].example=ex;
+            buf[k].value=value;
+        }
+        p=end;
+    }
+}
+
+/* The number of bytes needed to store x, at least one */
+static int bytesFor(unsigned int x){
+    int n;
+    for(n=1; n<4 && x>>(8*n); n++)
+        ;
+    return n;
+}
+
+static unsigned int getFixed(const unsigned char* p, int w){
+    switch(w){
+        case 1: return p[0];
+        case 2: return p[0]|p[1]<<8;
+        case 3: return p[0]|p[1]<<8|p[2]<<16;
+        default: return p[0]|p[1]<<8|p[2]<<16|(unsigned int)p[3]<<24;
+    }
+}
+
+static void putFixed(unsigned char* p, unsigned int x, int w){
+    int k;
+    for(k=0; k<w; k++)
+        p[k]=x>>(8*k);
+}
+
+/* The distinct values and the example ids of all the pairs in order, in
+ * as many bytes as the largest of them needs. The values (only if the
+ * feature is continuous, otherwise they are 1) are stored as the first one
+ * (see orderedBits) and the differences of the others from the previous
+ * one in as many bytes as the largest of them needs. They are preceded by
+ * the runs of more than one pair as the difference of the index of their
+ * value from the previous such run and the number of pairs. Everything
+ * that is read for every pair has a fixed width, which makes this faster
+ * to decode than packRuns, and it suits features with many distinct values,
+ * where packRuns spends a few bytes on every run. Returns the number of
+ * bytes used, nothing is written if p is NULL. */
+static size_t packFixed(const evpair_t* b, int size, int cont, unsigned char* p){
+    size_t len,nmulti;
+    int i,j,r,prev,w=1,vw=0,nruns=0;
+    for(i=0; i<size; i++){
+        nruns+=i==0 || b[i].value!=b[i-1].value;
+        if(cont && i>0 && b[i].value!=b[i-1].value && bytesFor(orderedBits(b[i].value)-orderedBits(b[i-1].value))>vw)
+            vw=bytesFor(orderedBits(b[i].value)-orderedBits(b[i-1].value));
+        if(bytesFor(b[i].example)>w)
+            w=bytesFor(b[i].example);
+    }
+    for(nmulti=0, i=0, r=0, prev=0; i<size; i=j, r++){
+        for(j=i+1; j<size && b[j].value==b[i].value; j++)
+            ;
+        if(j-i>1){
+            nmulti+=putVarint(NULL,r-prev)+putVarint(NULL,j-i);
+            prev=r;
+        }
+    }
+    len=putVarint(p,nruns);
+    len+=putVarint(p ? p+len : NULL, nmulti);
+    if(p){
+        p[len]=w;
+        p[len+1]=vw;
+    }
+    len+=2;
+    for(i=0, r=0, prev=0; i<size; i=j, r++){
+        for(j=i+1; j<size && b[j].value==b[i].value; j++)
+            ;
+        if(j-i>1){
+            len+=putVarint(p ? p+len : NULL, r-prev);
+            len+=putVarint(p ? p+len : NULL, j-i);
+            prev=r;
+        }
+    }
+    if(cont && size>0){
+        if(p)
+            putFixed(p+len,orderedBits(b[0].value),4);
+        len+=4;
+        for(i=1; i<size; i++){
+            if(b[i].value==b[i-1].value)
+                continue;
+            if(p)
+                putFixed(p+len,orderedBits(b[i].value)-orderedBits(b[i-1].value),vw);
+            len+=vw;
+        }
+    }
+    for(i=0; i<size; i++, len+=w){
+        if(p)
+            putFixed(p+len,b[i].example,w);
+    }
+    return len;
+}
+
+/* Read n example ids of w bytes each into buf */
+static void getIds(const unsigned char* p, int n, int w, evpair_t* buf){
+    int j;
+    switch(w){
+        case 1:
+            for(j=0; j<n; j++, p+=1)
+                buf[j].example=p[0];
+            break;
+        case 2:
+            for(j=0; j<n; j++, p+=2)
+                buf[j].example=p[0]|p[1]<<8;
+            break;
+        case 3:
+            for(j=0; j<n; j++, p+=3)
+                buf[j].example=p[0]|p[1]<<8|p[2]<<16;
+            break;
+        default:
+            for(j=0; j<n; j++, p+=4)
+                buf[j].example=getFixed(p,4);
+    }
+}
+
+static void unpackFixed(const unsigned char* p, int cont, evpair_t* buf){
+    const unsigned char *multi,*end;
+    int i,j,n,w,vw,nruns,next;
+    unsigned int last=0;
+    nruns=getVarint(&p);
+    n=getVarint(&p);
+    w=p[0];
+    vw=p[1];
+    multi=p+2;
+    end=multi+n;
+    p=end;
+    if(cont && nruns>0){
+        last=getFixed(p,4);
+        p+=4;
+    }
+    next=multi<end ? (int)getVarint(&multi) : nruns;
+    for(i=0, j=0; i<nruns; i++){
+        /* The runs before next have one pair */
+        for(; i<next; i++, j++){
+            if(cont && i>0){
+                last+=getFixed(p,vw);
+                p+=vw;
+            }
+            buf[j].value=cont ? orderedFloat(last) : 1;
+        }
+        if(i==nruns)
+            break;
+        if(cont && i>0){
+            last+=getFixed(p,vw);
+            p+=vw;
+        }
+        for(n=getVarint(&multi); n>0; n--, j++)
+            buf[j].value=cont ? orderedFloat(last) : 1;
+        next=multi<end ? next+(int)getVarint(&multi) : nruns;
+    }
+    getIds(p,j,w,buf);
+}
+
+/* Room that packColumn may need for a column of size pairs */
+static size_t packBound(int size){
+    return size*sizeof(evpair_t)+16;
+}
+
+/* Compress the column b of size pairs into p, which has room for
+ * packBound(size) bytes, and return the number of bytes used. The column
+ * is stored as a table of the values over the ids (packFixed) or as runs of
+ * equal values (packRuns), whichever takes less room, or as the pairs
+ * themselves if neither is smaller. */
+static size_t packColumn(const evpair_t* b, int size, int cont, unsigned char* p){
+    size_t len,best;
+    int tag=PACKRAW;
+
+    best=size*sizeof(evpair_t);
+    len=packFixed(b,size,cont,NULL);
+    if(len<best){
+        tag=PACKFIXED;
+        best=len;
+    }
+    /* Runs are slower to decode, so they have to save a quarter */
+    len=packRuns(b,size,cont,NULL);
+    if(len<(tag==PACKFIXED ? best-best/4 : best)){
+        tag=PACKRUNS;
+        best=len;
+    }
+    len=putVarint(p,4*best+tag);
+    if(tag==PACKFIXED)
+        packFixed(b,size,cont,p+len);
+    else if(tag==PACKRUNS)
+        packRuns(b,size,cont,p+len);
+    else
+        memcpy(p+len,b,best);
+    return len+best;
+}
+
+/* Decode the column of size pairs compressed at p into buf */
+static void unpackColumn(const unsigned char* p, int size, int cont, evpair_t* buf){
+    int tag=getVarint(&p)&3;
+    if(tag==PACKFIXED)
+        unpackFixed(p,cont,buf);
+    else if(tag==PACKRUNS)
+        unpackRuns(p,size,cont,buf);
+    else
+        memcpy(buf,p,size*sizeof(evpair_t));
+}
+
+/* Compress the column b at offset len of *bytes, which is made larger
+ * than its cap bytes if needed. Returns the new length. */
+static size_t appendColumn(unsigned char** bytes, size_t* cap, size_t len, const evpair_t* b, int size, int cont){
+    while(len+packBound(size)>*cap){
+        *cap*=2;
+        *bytes=realloc(*bytes,*cap);
+    }
+    return len+packColumn(b,size,cont,*bytes+len);
+}
+
+/* Store the features of d compressed. Binary features shrink the most, 
+ * since their values are not stored and the gaps between the ids of the 
+ * examples that have them are usually small. Use getColumn to read them. */
+void packData(dataset_t* d){
+    int i;
+    size_t len=0,cap=1024;
+    size_t* offset;
+
+    if(d->packed)
+        return;
+    startPhase(PACK);
+    offset=malloc((d->nfeat+1)*sizeof(size_t));
+    d->bytes=malloc(cap);
+    for(i=0; i<d->nfeat; i++){
+        offset[i]=len;
+        if(!d->dense[i])
+            len=appendColumn(&d->bytes,&cap,len,d->feature[i],d->size[i],d->cont[i]);
+    }
+    d->bytes=realloc(d->bytes,len+1);
+    d->packed=malloc((d->nfeat+1)*sizeof(unsigned char*));
+    for(i=0; i<d->nfeat; i++)
+        d->packed[i]=d->bytes+offset[i];
+    free(offset);
+    freePairs(d);
+    free(d->feature);
+    d->feature=NULL;
+    stopPhase(PACK);
+}
+
+/* The pairs of feature i. If d is packed they are decoded into buf (see
+ * columnBuffer), otherwise they are not copied. */
+evpair_t* getColumn(const dataset_t* d, int i, evpair_t* buf){
+    if(d->packed==NULL)
+        return d->feature[i];
+    /* Features without pairs, such as those added by alignData, have no bytes */
+    if(d->size[i]>0)
+        unpackColumn(d->packed[i],d->size[i],d->cont[i],buf);
+    return buf;
+}
+
+/* Room for the largest feature of d if it is packed, NULL otherwise */
+evpair_t* columnBuffer(const dataset_t* d){
+    int i,max=1;
+    if(d->packed==NULL)
+        return NULL;
+    for(i=0; i<d->nfeat; i++){
+        if(d->size[i]>max)
+            max=d->size[i];
+    }
+    return malloc(max*sizeof(evpair_t));
+}
+
+/* Bytes taken by the compressed feature i */
+static size_t packedLength(const dataset_t* d, int i){
+    const unsigned char* p=d->packed[i];
+    size_t n=getVarint(&p)/4;
+    return p-d->packed[i]+n;
+}
+
+/* Pairs that loadPackedData sorts and compresses at a time */
+#define CHUNKPAIRS (1<<20)
+
+/* Part of the data, sorted and compressed by feature while loadPackedData
+ * reads the rest */
+typedef struct chunk_t{
+    unsigned char* bytes;
+    int* feature;   /* ids of its features, in increasing order */
+    size_t* start;  /* where each one starts in bytes */
+    int* size;      /* and its number of pairs */
+    int* cont;
+    int nfeat;
+    int next;       /* the first of its features that is not merged yet */
+}chunk_t;
+
+/* Sort the pairs em/fm[0..n-1] and compress every feature into c */
+static void packChunk(evpair_t* em, int* fm, int n, chunk_t* c){
+    int i,j,k;
+    size_t len=0,cap=1024;
+
+    startPhase(SORT);
+    sort(em,fm,n);
+    stopPhase(SORT);
+    startPhase(PACK);
+    for(c->nfeat=0, i=0; i<n; i++)
+        c->nfeat+=i==0 || fm[i]!=fm[i-1];
+    c->feature=malloc((c->nfeat+1)*sizeof(int));
+    c->start=malloc((c->nfeat+1)*sizeof(size_t));
+    c->size=malloc((c->nfeat+1)*sizeof(int));
+    c->cont=calloc(c->nfeat+1,sizeof(int));
+    c->bytes=malloc(cap);
+    for(k=0, i=0; i<n; i=j, k++){
+        for(j=i; j<n && fm[j]==fm[i]; j++)
+            c->cont[k]|=em[j].value!=1;
+        c->feature[k]=fm[i];
+        c->start[k]=len;
+        c->size[k]=j-i;
+        len=appendColumn(&c->bytes,&cap,len,em+i,j-i,c->cont[k]);
+    }
+    c->bytes=realloc(c->bytes,len+1);
+    c->next=0;
+    stopPhase(PACK);
+}
+
+static void freeChunk(chunk_t* c){
+    free(c->bytes);
+    free(c->feature);
+    free(c->start);
+    free(c->size);
+    free(c->cont);
+}
+
+/* Is the next feature of chunk a merged before that of chunk b? */
+static int chunkBefore(const chunk_t* a, const chunk_t* b){
+    if(a->feature[a->next]!=b->feature[b->next])
+        return a->feature[a->next]<b->feature[b->next];
+    return a<b;
+}
+
+/* Restore the order of a heap of chunks whose root may be out of place */
+static void siftChunks(chunk_t* chunk, int* heap, int n){
+    int i=0,c,t;
+    while((c=2*i+1)<n){
+        if(c+1<n && chunkBefore(&chunk[heap[c+1]],&chunk[heap[c]]))
+            c++;
+        if(!chunkBefore(&chunk[heap[c]],&chunk[heap[i]]))
+            break;
+        t=heap[i]; heap[i]=heap[c]; heap[c]=t;
+        i=c;
+    }
+}
+
+/* Merge the sorted pieces a[at[s]..at[s+1]-1], s=0..k-1, into b. pos and
+ * heap need room for k ints. */
+static void mergePieces(evpair_t* a, const int* at, int k, evpair_t* b, int* pos, int* heap){
+    int i,j,n,c,t,s;
+    for(n=0, s=0; s<k; s++){
+        pos[s]=at[s];
+        if(pos[s]<at[s+1])
+            heap[n++]=s;
+    }
+    /* The pieces are few, so the heap is built by sifting every one up */
+    for(i=1; i<n; i++){
+        for(j=i; j>0 && before(0,&a[pos[heap[j]]],0,&a[pos[heap[(j-1)/2]]]); j=(j-1)/2){
+            t=heap[j]; heap[j]=heap[(j-1)/2]; heap[(j-1)/2]=t;
+        }
+    }
+    for(j=0; n>0; j++){
+        s=heap[0];
+        b[j]=a[pos[s]++];
+        if(pos[s]==at[s+1])
+            heap[0]=heap[--n];
+        for(i=0; (c=2*i+1)<n; i=c){
+            if(c+1<n && before(0,&a[pos[heap[c+1]]],0,&a[pos[heap[c]]]))
+                c++;
+            if(!before(0,&a[pos[heap[c]]],0,&a[pos[heap[i]]]))
+                break;
+            t=heap[i]; heap[i]=heap[c]; heap[c]=t;
+        }
+    }
+}
+
+/* Same as loadShard followed by packData, but the pairs are never all in
+ * memory: every CHUNKPAIRS of them are sorted and compressed as they are
+ * read, and at the end the pieces of each feature are merged and
+ * compressed again, one feature at a time. */
+void loadPackedData(const char* name, dataset_t* d, int nshards, int shard){
+    FILE* fp;
+    char* line=NULL;
+    size_t linecap=0;
+    ssize_t len;
+    evpair_t* em;
+    int* fm;
+    chunk_t* chunk;
+    chunk_t* c;
+    int* heap;
+    int* at;
+    int* pos;
+    int* sel;
+    int* idx;
+    int* mheap;
+    size_t* offset;
+    evpair_t* piece;
+    evpair_t* column;
+    size_t bytes,bytecap;
+    int i,k,n,s,cap,nchunks,chunkcap,nheap,ntarget,featcap,colcap,id;
+
+    fp=openData(name);
+    if(fp==NULL){
+        printf("Could not open file %s\n",name);
+        exit(1);
+    }
+    cap=CHUNKPAIRS;
+    em=malloc(cap*sizeof(evpair_t));
+    fm=malloc(cap*sizeof(int));
+    ntarget=1024;
+    d->target=malloc(ntarget*sizeof(int));
+    chunkcap=16;
+    chunk=malloc(chunkcap*sizeof(chunk_t));
+    nchunks=0;
+    n=0;
+    d->nex=0;
+    startPhase(PARSE);
+    while((len=getline(&line,&linecap,fp))!=-1){
+        /* A line has fewer pairs than characters */
+        if(n+len>cap && n>0){
+            if(nchunks==chunkcap){
+                chunkcap*=2;
+                chunk=realloc(chunk,chunkcap*sizeof(chunk_t));
+            }
+            stopPhase(PARSE);
+            packChunk(em,fm,n,&chunk[nchunks++]);
+            startPhase(PARSE);
+            n=0;
+        }
+        if(len>cap){
+            cap=len;
+            em=realloc(em,cap*sizeof(evpair_t));
+            fm=realloc(fm,cap*sizeof(int));
+        }
+        if(d->nex==ntarget){
+            ntarget*=2;
+            d->target=realloc(d->target,ntarget*sizeof(int));
+        }
+        k=readPairs(line,d->nex,em+n,fm+n,&d->target[d->nex]);
+        if(k<0)
+            continue;
+        if(nshards>1)
+            k=keepShard(em+n,fm+n,k,nshards,shard);
+        n+=k;
+        d->nex+=1;
+    }
+    closeData(fp);
+    free(line);
+    stopPhase(PARSE);
+    if(n>0){
+        if(nchunks==chunkcap){
+            chunkcap*=2;
+            chunk=realloc(chunk,chunkcap*sizeof(chunk_t));
+        }
+        packChunk(em,fm,n,&chunk[nchunks++]);
+    }
+    free(em);
+    free(fm);
+    d->oobvotes=calloc(d->nex,sizeof(int));
+    d->weight=malloc(d->nex*sizeof(float));
+    d->use=NULL;
+    d->count=NULL;
+    d->pairs=NULL;
+    d->feature=NULL;
+    d->mapsize=0;
+
+    /* Merge the pieces of every feature, in increasing order of id */
+    startPhase(PACK);
+    heap=malloc((nchunks+1)*sizeof(int));
+    sel=malloc((nchunks+1)*sizeof(int));
+    idx=malloc((nchunks+1)*sizeof(int));
+    mheap=malloc((nchunks+1)*sizeof(int));
+    at=malloc((nchunks+1)*sizeof(int));
+    pos=malloc((nchunks+1)*sizeof(int));
+    for(nheap=0, i=0; i<nchunks; i++){
+        if(chunk[i].nfeat==0){
+            freeChunk(&chunk[i]);
+            continue;
+        }
+        heap[nheap++]=i;
+        for(k=nheap-1; k>0 && chunkBefore(&chunk[heap[k]],&chunk[heap[(k-1)/2]]); k=(k-1)/2){
+            s=heap[k]; heap[k]=heap[(k-1)/2]; heap[(k-1)/2]=s;
+        }
+    }
+    featcap=1024;
+    d->featid=malloc(featcap*sizeof(int));
+    d->size=malloc(featcap*sizeof(int));
+    d->cont=malloc(featcap*sizeof(int));
+    d->dense=malloc(featcap*sizeof(dense_t*));
+    offset=malloc(featcap*sizeof(size_t));
+    colcap=1024;
+    piece=malloc(colcap*sizeof(evpair_t));
+    column=malloc(colcap*sizeof(evpair_t));
+    bytecap=1024;
+    d->bytes=malloc(bytecap);
+    bytes=0;
+    d->nfeat=0;
+    while(nheap>0){
+        /* Take the next feature out of the chunks that have it */
+        id=chunk[heap[0]].feature[chunk[heap[0]].next];
+        for(k=0, n=0; nheap>0 && chunk[heap[0]].feature[chunk[heap[0]].next]==id; k++){
+            c=&chunk[heap[0]];
+            sel[k]=heap[0];
+            idx[k]=c->next++;
+            n+=c->size[idx[k]];
+            if(c->next==c->nfeat)
+                heap[0]=heap[--nheap];
+            siftChunks(chunk,heap,nheap);
+        }
+        if(n>colcap){
+            while(n>colcap)
+                colcap*=2;
+            piece=realloc(piece,colcap*sizeof(evpair_t));
+            column=realloc(column,colcap*sizeof(evpair_t));
+        }
+        for(at[0]=0, s=0; s<k; s++){
+            c=&chunk[sel[s]];
+            i=idx[s];
+            unpackColumn(c->bytes+c->start[i],c->size[i],c->cont[i],piece+at[s]);
+            at[s+1]=at[s]+c->size[i];
+            if(c->next==c->nfeat)
+                freeChunk(c);
+        }
+        mergePieces(piece,at,k,column,pos,mheap);
+        if(d->nfeat==featcap){
+            featcap*=2;
+            d->featid=realloc(d->featid,featcap*sizeof(int));
+            d->size=realloc(d->size,featcap*sizeof(int));
+            d->cont=realloc(d->cont,featcap*sizeof(int));
+            d->dense=realloc(d->dense,featcap*sizeof(dense_t*));
+            offset=realloc(offset,featcap*sizeof(size_t));
+        }
+        d->featid[d->nfeat]=id;
+        d->size[d->nfeat]=n;
+        for(d->cont[d->nfeat]=0, i=0; i<n; i++)
+            d->cont[d->nfeat]|=column[i].value!=1;
+        d->dense[d->nfeat]=denseFeature(column,n,d->nex);
+        offset[d->nfeat]=bytes;
+        if(!d->dense[d->nfeat])
+            bytes=appendColumn(&d->bytes,&bytecap,bytes,column,n,d->cont[d->nfeat]);
+        d->nfeat+=1;
+    }
+    d->bytes=realloc(d->bytes,bytes+1);
+    d->packed=malloc((d->nfeat+1)*sizeof(unsigned char*));
+    for(i=0; i<d->nfeat; i++)
+        d->packed[i]=d->bytes+offset[i];
+    plainIds(d);
+    free(offset);
+    free(piece);
+    free(column);
+    free(heap);
+    free(sel);
+    free(idx);
+    free(mheap);
+    free(at);
+    free(pos);
+    free(chunk);
+    stopPhase(PACK);
+}
+
+/* Bytes that the features lo..hi-1 take in the storage of d, which is the
+ * pairs or, if d is packed, the compressed bytes. Dense features take none. */
+size_t columnBytes(const dataset_t* d, int lo, int hi){
+    size_t n=0;
+    int i;
+    if(lo>=hi)
+        return 0;
+    if(d->packed)
+        return d->packed[hi-1]-d->packed[lo]+(d->dense[hi-1] ? 0 : packedLength(d,hi-1));
+    for(i=lo; i<hi; i++)
+        n+=d->dense[i] ? 0 : d->size[i]*sizeof(evpair_t);
+    return n;
+}
+
+/* Make storage, to which all the features were moved, the storage of d */
+void setStorage(dataset_t* d, void* storage){
+    if(d->packed){
+        free(d->bytes);
+        d->bytes=storage;
+    }
+    else{
+        freePairs(d);
+        d->pairs=storage;
+    }
+}
+
+/* Copy the features lo..hi-1 to dst, which has room for columnBytes of
+ * them, and to new bins if they are dense. The copies are written by the
+ * calling thread, so the operating system puts them in memory near it.
+ * The caller replaces the storage of d once all the features are moved. */
+void moveColumns(dataset_t* d, int lo, int hi, void* dst){
+    unsigned char* p=dst;
+    unsigned char* bin;
+    size_t n;
+    int i;
+    for(i=lo; i<hi; i++){
+        if(d->dense[i]){
+            bin=malloc(d->nex);
+            memcpy(bin,d->dense[i]->bin,d->nex);
+            free(d->dense[i]->bin);
+            d->dense[i]->bin=bin;
+            if(d->packed)
+                d->packed[i]=p;
+        }
+        else if(d->packed){
+            n=packedLength(d,i);
+            memcpy(p,d->packed[i],n);
+            d->packed[i]=p;
+            p+=n;
+        }
+        else{
+            n=d->size[i]*sizeof(evpair_t);
+            memcpy(p,d->feature[i],n);
+            d->feature[i]=(evpair_t*)p;
+            p+=n;
+        }
+    }
+}
+
+/* Position of feature id in the sorted array featid or -1 if it is not there */
+int findFeature(const int* featid, int nfeat, int id){
+    int l=0,u=nfeat,m;
+    while(l<u){
+        m=(l+u)/2;
+        if(featid[m]<id)
+            l=m+1;
+        else
+            u=m;
+    }
+    return l<nfeat && featid[l]==id ? l : -1;
+}
+
+/* Renumber the features of d to match a dataset with the given feature ids
+ * (NULL means 0..nfeat-1), so that a tree grown on that dataset can be used
+ * on d. Features of d that the other dataset does not have are dropped.
+ */
+void alignData(dataset_t* d, const int* featid, int nfeat){
+    int i,j;
+    int* size=calloc(nfeat,sizeof(int));
+    int* cont=calloc(nfeat,sizeof(int));
+    evpair_t** feature=d->packed ? NULL : malloc(nfeat*sizeof(evpair_t*));
+    unsigned char** packed=d->packed ? malloc(nfeat*sizeof(unsigned char*)) : NULL;
+    dense_t** dense=calloc(nfeat,sizeof(dense_t*));
+
+    for(i=0; i<nfeat; i++){
+        if(packed)
+            packed[i]=d->bytes;
+        else
+            feature[i]=d->pairs;
+        j=featid ? featid[i] : i;
+        if(d->featid)
+            j=findFeature(d->featid,d->nfeat,j);
+        else if(j>=d->nfeat)
+            j=-1;
+        if(j<0)
+            continue;
+        if(packed)
+            packed[i]=d->packed[j];
+        else
+            feature[i]=d->feature[j];
+        dense[i]=d->dense[j];
+        d->dense[j]=NULL;
+        size[i]=d->size[j];
+        cont[i]=d->cont[j];
+    }
+    /* Features that were dropped */
+    for(j=0; j<d->nfeat; j++){
+        if(d->dense[j]){
+            free(d->dense[j]->bin);
+            free(d->dense[j]);
+        }
+    }
+    free(d->dense);
+    free(d->feature);
+    free(d->packed);
+    free(d->size);
+    free(d->cont);
+    free(d->featid);
+    d->feature=feature;
+    d->packed=packed;
+    d->dense=dense;
+    d->size=size;
+    d->cont=cont;
+    d->nfeat=nfeat;
+    d->featid=NULL;
+    if(featid){
+        d->featid=malloc(nfeat*sizeof(int));
+        memcpy(d->featid,featid,nfeat*sizeof(int));
+    }
+}
+
+/* The rows of the copy of d that subsetData makes. Returns map, where
+ * map[x] is the new number of example x or -1 if keep[x] <= 0. The columns
+ * are then counted, allocated and filled by the functions below, which
+ * subsetData calls for all the features and a pool (see pool.c) calls for
+ * the features of each thread. */
+int* subsetRows(dataset_t* sub, const dataset_t* d, const int* keep){
+    int i,n;
+    int* map=malloc((d->nex+1)*sizeof(int));
+
+    for(n=0, i=0; i<d->nex; i++)
+        map[i]=keep[i]>0 ? n++ : -1;
+    sub->nex=n;
+    sub->target=malloc((n+1)*sizeof(int));
+    sub->weight=malloc((n+1)*sizeof(float));
+    for(i=0; i<d->nex; i++){
+        if(map[i]<0)
+            continue;
+        sub->target[map[i]]=d->target[i];
+        sub->weight[map[i]]=d->weight[i];
+    }
+    sub->oobvotes=calloc(n+1,sizeof(int));
+    sub->use=NULL;
+    sub->count=NULL;
+    sub->packed=NULL;
+    sub->bytes=NULL;
+    sub->mapsize=0;
+    sub->featid=NULL;
+    sub->nfeat=d->nfeat;
+    sub->size=calloc(d->nfeat+1,sizeof(int));
+    sub->cont=malloc((d->nfeat+1)*sizeof(int));
+    memcpy(sub->cont,d->cont,d->nfeat*sizeof(int));
+    sub->dense=calloc(d->nfeat+1,sizeof(dense_t*));
+    sub->feature=calloc(d->nfeat+1,sizeof(evpair_t*));
+    return map;
+}
+
+/* The sizes of the features lo..hi-1 of sub. buf is from columnBuffer(d). */
+void countSubset(dataset_t* sub, const dataset_t* d, const int* map, int lo, int hi, evpair_t* buf){
+    int i,j;
+    evpair_t* b;
+    for(i=lo; i<hi; i++){
+        if(d->dense[i])
+            continue;
+        b=getColumn(d,i,buf);
+        for(j=0; j<d->size[i]; j++)
+            sub->size[i]+=map[b[j].example]>=0;
+    }
+}
+
+/* Storage for the pairs of sub once every size is known. It is not
+ * touched here, so its pages go where fillSubset first writes them. */
+void allocSubset(dataset_t* sub){
+    int i;
+    size_t total;
+    for(total=0, i=0; i<sub->nfeat; i++)
+        total+=sub->size[i];
+    sub->pairs=malloc((total>0 ? total : 1)*sizeof(evpair_t));
+    for(total=0, i=0; i<sub->nfeat; i++){
+        sub->feature[i]=sub->pairs+total;
+        total+=sub->size[i];
+    }
+}
+
+/* Copy the features lo..hi-1 of d to sub, keeping the pairs of every
+ * feature in the same order */
+void fillSubset(dataset_t* sub, const dataset_t* d, const int* map, int lo, int hi, evpair_t* buf){
+    int i,j,n;
+    evpair_t* b;
+    dense_t* dn;
+    for(i=lo; i<hi; i++){
+        if(d->dense[i]){
+            dn=malloc(sizeof(dense_t));
+            *dn=*d->dense[i];
+            dn->bin=malloc(sub->nex>0 ? sub->nex : 1);
+            for(j=0; j<d->nex; j++){
+                if(map[j]>=0)
+                    dn->bin[map[j]]=d->dense[i]->bin[j];
+            }
+            sub->dense[i]=dn;
+            sub->feature[i]=NULL;
+            continue;
+        }
+        b=getColumn(d,i,buf);
+        for(n=0, j=0; j<d->size[i]; j++){
+            if(map[b[j].example]<0)
+                continue;
+            sub->feature[i][n].example=map[b[j].example];
+            sub->feature[i][n].value=b[j].value;
+            n++;
+        }
+    }
+}
+
+/* A copy of the examples x of d with keep[x] > 0, renumbered 0,1,... in
+ * their original order. The pairs of every feature stay in the same order,
+ * so a tree grown on sub only scans these examples but is the same as one
+ * grown on d with valid = keep. Free it with freeData.
+ */
+void subsetData(dataset_t* sub, const dataset_t* d, const int* keep){
+    int* map=subsetRows(sub,d,keep);
+    evpair_t* buf=columnBuffer(d);
+    countSubset(sub,d,map,0,d->nfeat,buf);
+    allocSubset(sub);
+    fillSubset(sub,d,map,0,d->nfeat,buf);
+    free(map);
+    free(buf);
+}
+
+/* A dataset with the given features but no examples. It stands for data
+ * that other processes hold (see cluster.c). */
+void emptyData(dataset_t* d, int nfeat, const int* featid, const int* cont){
+    int i;
+    d->nex=0;
+    d->nfeat=nfeat;
+    d->target=malloc(sizeof(int));
+    d->weight=malloc(sizeof(float));
+    d->oobvotes=malloc(sizeof(int));
+    d->use=NULL;
+    d->count=NULL;
+    d->packed=NULL;
+    d->bytes=NULL;
+    d->mapsize=0;
+    d->pairs=malloc(sizeof(evpair_t));
+    d->feature=malloc((nfeat+1)*sizeof(evpair_t*));
+    for(i=0; i<nfeat; i++)
+        d->feature[i]=d->pairs;
+    d->dense=calloc(nfeat+1,sizeof(dense_t*));
+    d->size=calloc(nfeat+1,sizeof(int));
+    d->cont=malloc((nfeat+1)*sizeof(int));
+    memcpy(d->cont,cont,nfeat*sizeof(int));
+    d->featid=NULL;
+    if(featid){
+        d->featid=malloc(nfeat*sizeof(int));
+        memcpy(d->featid,featid,nfeat*sizeof(int));
+    }
+}
+
+/* A view shares the examples of d but has its own weights, so several
+ * forests can be grown from the same data at the same time. */
+void viewData(dataset_t* view, const dataset_t* d){
+    *view = *d;
+    view->weight=malloc(d->nex*sizeof(float));
+    view->oobvotes=calloc(d->nex,sizeof(int));
+    view->use=NULL;
+}
+
+void freeView(dataset_t* view){
+    free(view->weight);
+    free(view->oobvotes);
 }
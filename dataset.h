@@ -18,21 +18,66 @@ typedef struct evpair_t{
     float value; /* value of feature for this example */
 }evpair_t;
 
+#define MAXBINS 256 /* most distinct values (zero included) of a dense feature */
+
+/* A feature that most examples have. Instead of a list of pairs it is 
+ * stored as the index of the value of every example in a short table.
+ */
+typedef struct dense_t{
+    unsigned char* bin; /* bin[i] = index in value of the value of example i */
+    float value[MAXBINS]; /* the distinct values in increasing order */
+    int nbins; /* number of distinct values */
+    int zero; /* index of the value 0, -1 if all the examples have the feature */
+}dense_t;
+
 typedef struct dataset_t{
     evpair_t** feature; /* array of arrays of example value pairs */
+    evpair_t* pairs; /* storage of all the pairs, feature[i] points into it */
+    size_t mapsize; /* If not 0, pairs is a mapping of this many bytes of a file */
+    unsigned char** packed; /* If not NULL, feature i is stored compressed in packed[i] and feature is NULL */
+    unsigned char* bytes; /* storage of the compressed features, packed[i] points into it */
+    dense_t** dense; /* If dense[i] is not NULL, feature i is stored there and not as pairs */
     int* size; /* size[i]=number of examples with non-zero feature i */
     /* Would it be better if these were short/char?*/
     int* cont;  /* Is the ith feature continuous? */
     int* target; /* Target values */
     float* weight; /* Weight of the ith example */
     int nfeat; /* number of features */
+    int* featid; /* id of the ith feature in the input, NULL if it is i */
     int nex; /* number of examples */
     int* oobvotes;
+    int* use; /* If not NULL, only examples with use[i] != 0 are used for training */
+    int* count; /* If not NULL, example i stands for count[i] copies of it (see loadUniqueData) */
 }dataset_t;
 
 void loadData(const char* name, dataset_t* d);
-int getDimensions(FILE* fp, int* examples, int* features);
-int readExample(FILE* fp, int maxline, float* example, int nfeat, int* target);
+void loadShard(const char* name, dataset_t* d, int nshards, int shard);
+void loadUniqueData(const char* name, dataset_t* d);
+void loadRows(const char* name, dataset_t* d, int nshards, int shard, int unique);
+void loadDataOnDisk(const char* name, dataset_t* d, size_t memory, const char* dir);
+void loadPackedData(const char* name, dataset_t* d, int nshards, int shard);
+FILE* openData(const char* name);
+void closeData(FILE* fp);
+int readExample(FILE* fp, char** line, size_t* cap, float* example, int nfeat, const int* featid, int* target);
+int readSparseExample(FILE* fp, char** line, size_t* cap, float* example, int nfeat, const int* featid, int* target, int* active, int* nactive);
+int parseExample(char* line, float* example, int nfeat, const int* featid, int* target);
+void sort(evpair_t* a, int* f, int len);
+int findFeature(const int* featid, int nfeat, int id);
+void alignData(dataset_t* d, const int* featid, int nfeat);
+void packData(dataset_t* d);
+evpair_t* getColumn(const dataset_t* d, int i, evpair_t* buf);
+evpair_t* columnBuffer(const dataset_t* d);
+size_t columnBytes(const dataset_t* d, int lo, int hi);
+void moveColumns(dataset_t* d, int lo, int hi, void* dst);
+void setStorage(dataset_t* d, void* storage);
 void freeData(dataset_t* d);
+void emptyData(dataset_t* d, int nfeat, const int* featid, const int* cont);
+void subsetData(dataset_t* sub, const dataset_t* d, const int* keep);
+int* subsetRows(dataset_t* sub, const dataset_t* d, const int* keep);
+void countSubset(dataset_t* sub, const dataset_t* d, const int* map, int lo, int hi, evpair_t* buf);
+void allocSubset(dataset_t* sub);
+void fillSubset(dataset_t* sub, const dataset_t* d, const int* map, int lo, int hi, evpair_t* buf);
+void viewData(dataset_t* view, const dataset_t* d);
+void freeView(dataset_t* view);
 
 #endif /* DATASET_H */
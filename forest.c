@@ -8,54 +8,134 @@
 
 #include "tree.h"
 #include "forest.h"
+#include "metrics.h"
+#include "pool.h"
 #include <stdlib.h>
 #include <math.h>
+#include <float.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
-void initForest(forest_t* f, int committee, int maxdepth, float param, int trees, float wneg, int oob){
+void initForest(forest_t* f, int committee, int maxdepth, float param, int trees, float wneg, int oob, unsigned int seed){
     f->committee = committee;
     f->maxdepth = maxdepth;
     f->factor = param;
     f->ntrees = trees;
     f->ngrown = 0;
     f->wneg = wneg;
+    f->bootstrap = 1;
+    f->rate[0] = f->rate[1] = 1;
+    f->replace = 1;
+    f->levels = 0;
+    f->compacted = 0;
+    f->cluster = NULL;
+    f->pool = NULL;
     f->oob = oob;
+    f->seed = seed;
+    f->nfeat = 0;
+    f->featid = NULL;
+    f->minrest = NULL;
+    f->maxrest = NULL;
+    f->zero = NULL;
+    f->zerosum = NULL;
+    f->reach = NULL;
+    f->reachstart = NULL;
+    f->tree = NULL;
+    f->out = NULL;
+    f->outname = NULL;
+    f->outtemp = NULL;
+    f->validation = NULL;
+    f->patience = 0;
 }
 
 void freeForest(forest_t* f){
     int i;
-    for(i=0; i<f->ngrown; i++)
-        freeTree(f->tree[i]);
-    free(f->tree);
+    if(f->tree){
+        for(i=0; i<f->ngrown; i++)
+            freeTree(f->tree[i]);
+        free(f->tree);
+    }
+    free(f->minrest);
+    free(f->maxrest);
+    free(f->zero);
+    free(f->zerosum);
+    free(f->reach);
+    free(f->reachstart);
+    free(f->featid);
 }
 
-void tabulateOOBVotes(tree_t* tree, dataset_t* d) {
-    // classify the out-of-bag examples and record the votes
-    classifyOOBData(tree,tree->root,d);
-    int i;
-    for(i=0; i < d->nex; i++) {
-        if(d->weight[i] == 0) {
-            if (tree->pred[i] > 0.5)
-                d->oobvotes[i]+=1;
-            else
-                d->oobvotes[i]-=1;
-        }
+/* Examples that row i stands for, see loadUniqueData */
+static int copies(const dataset_t* d, int i){
+    return d->count ? d->count[i] : 1;
+}
+
+/* Running out-of-bag estimates. Every new tree only routes its own
+ * out-of-bag examples, and the confusion matrix is updated from the 
+ * examples whose vote changed instead of being recounted.
+ */
+typedef struct oob_t{
+    int* list;       /* out-of-bag examples of the current tree */
+    int* mark;       /* scratch space for routeExamples */
+    evpair_t* column;/* scratch space for routeExamples */
+    node_t** leaf;   /* leaf of the current tree reached by each example */
+    float* prob;     /* sum of the out-of-bag probabilities of each example */
+    int* count;      /* number of trees for which each example was out-of-bag */
+    int confusion[2][2];
+} oob_t;
+
+void initOOB(oob_t* o, dataset_t* d){
+    o->list = malloc(d->nex*sizeof(int));
+    o->mark = calloc(d->nex,sizeof(int));
+    o->column = columnBuffer(d);
+    o->leaf = malloc(d->nex*sizeof(node_t*));
+    o->prob = calloc(d->nex,sizeof(float));
+    o->count = calloc(d->nex,sizeof(int));
+    o->confusion[0][0] = o->confusion[0][1] = 0;
+    o->confusion[1][0] = o->confusion[1][1] = 0;
+}
+
+void freeOOB(oob_t* o){
+    free(o->list);
+    free(o->mark);
+    free(o->column);
+    free(o->leaf);
+    free(o->prob);
+    free(o->count);
+}
+
+void updateOOB(oob_t* o, node_t* root, dataset_t* d){
+    int i,j,n,old;
+    float p;
+
+    startPhase(OOB);
+    for(n=0, i=0; i<d->nex; i++){
+        if(d->weight[i] == 0 && (d->use == NULL || d->use[i]))
+            o->list[n++] = i;
     }
+    routeExamples(root, d, o->list, n, o->mark, o->leaf, o->column);
+    for(j=0; j<n; j++){
+        i = o->list[j];
+        p = classifyBag(o->leaf[i], NULL);
+        o->prob[i] += p;
+        o->count[i] += 1;
+        /* Ties are not counted */
+        old = d->oobvotes[i];
+        d->oobvotes[i] += p > 0.5 ? 1 : -1;
+        if(old != 0)
+            o->confusion[d->target[i]][old > 0] -= copies(d, i);
+        if(d->oobvotes[i] != 0)
+            o->confusion[d->target[i]][d->oobvotes[i] > 0] += copies(d, i);
+    }
+    stopPhase(OOB);
 }
 
-void reportOOBError(dataset_t* d, int iter) {
+void reportOOBError(oob_t* o, int iter) {
     float tp,fp,tn,fn;
-    int confusion[2][2]={{0,0},{0,0}};
-    int i;
-    for (i=0; i < d->nex; i++) {
-        if(d->oobvotes[i] == 0)
-            continue;
-        int margin = d->oobvotes[i] > 0 ? 1 : 0;
-        confusion[d->target[i]][margin]+=1;
-    }
-    tp=confusion[1][1];
-    fn=confusion[1][0];
-    fp=confusion[0][1];
-    tn=confusion[0][0];
+    tp=o->confusion[1][1];
+    fn=o->confusion[1][0];
+    fp=o->confusion[0][1];
+    tn=o->confusion[0][0];
 
     float acc = (tp+tn) / (tp+tn+fp+fn);
     float sens = tp / (tp+fn);  // acc on pos examples = recall
@@ -68,144 +148,817 @@ void reportOOBHeader() {
     printf("%5s  %6s  %6s  %6s\n","tree","err","negerr","poserr");
 }
 
+/* The AUC needs a sort so it is only reported once, for the whole forest.
+ * A row is repeated once for every example it stands for. */
+void reportOOBAUC(oob_t* o, dataset_t* d) {
+    int i,j,n;
+    float* pred;
+    int* target;
+    for(n=0, i=0; i<d->nex; i++)
+        n += o->count[i] ? copies(d,i) : 0;
+    pred = malloc((n+1)*sizeof(float));
+    target = malloc((n+1)*sizeof(int));
+    for(n=0, i=0; i<d->nex; i++){
+        if(o->count[i] == 0)
+            continue;
+        for(j=0; j<copies(d,i); j++){
+            pred[n] = o->prob[i]/o->count[i];
+            target[n] = d->target[i];
+            n++;
+        }
+    }
+    printf("Out of bag AUC: %6.4f (%d examples)\n", areaUnderROC(pred, target, n), n);
+    free(pred);
+    free(target);
+}
+
+/* Running margins of the validation examples for early stopping. Only
+ * the newest tree has to be evaluated after every round of boosting.
+ */
+typedef struct early_t{
+    int* list;       /* all the validation examples */
+    int* mark;       /* scratch space for routeExamples */
+    evpair_t* column;/* scratch space for routeExamples */
+    node_t** leaf;   /* leaf of the current tree reached by each example */
+    float* margin;   /* sum of the outputs of the trees so far */
+    float* prob;     /* predicted probability of the positive class */
+    long* end;       /* offset in the model file after each tree */
+    float bestloss;
+    int best;        /* number of trees with the lowest loss so far */
+} early_t;
+
+void initEarly(early_t* e, dataset_t* v, int trees){
+    int i;
+    e->list = malloc(v->nex*sizeof(int));
+    for(i=0; i<v->nex; i++)
+        e->list[i] = i;
+    e->mark = calloc(v->nex,sizeof(int));
+    e->column = columnBuffer(v);
+    e->leaf = malloc(v->nex*sizeof(node_t*));
+    e->margin = calloc(v->nex,sizeof(float));
+    e->prob = malloc(v->nex*sizeof(float));
+    e->end = calloc(trees,sizeof(long));
+    e->bestloss = FLT_MAX;
+    e->best = 0;
+    printf("Validation log-loss and error rate\n");
+    printf("%5s  %7s  %6s\n","tree","logloss","err");
+}
+
+void freeEarly(early_t* e){
+    free(e->list);
+    free(e->mark);
+    free(e->column);
+    free(e->leaf);
+    free(e->margin);
+    free(e->prob);
+    free(e->end);
+}
+
+/* Add tree iter to the margins and report the loss of the first iter+1 trees */
+void updateEarly(early_t* e, node_t* root, dataset_t* v, int iter){
+    int i;
+    double loss = 0;
+
+    startPhase(VALIDATE);
+    routeExamples(root, v, e->list, v->nex, e->mark, e->leaf, e->column);
+    for(i=0; i<v->nex; i++){
+        e->margin[i] += classifyBoost(e->leaf[i], NULL);
+        /* Boosting estimates half the log odds */
+        e->prob[i] = 1.0f/(1.0f+expf(-2*e->margin[i]));
+        if(v->target[i])
+            loss -= log(fmaxf(e->prob[i], FLT_EPSILON));
+        else
+            loss -= log(fmaxf(1-e->prob[i], FLT_EPSILON));
+    }
+    loss /= v->nex;
+    if(loss < e->bestloss){
+        e->bestloss = loss;
+        e->best = iter+1;
+    }
+    stopPhase(VALIDATE);
+    printf("%5d  %7.4f  %5.2f%%\n", iter+1, loss, 100*errorRate(e->prob, v->target, v->nex, 0.5));
+}
+
+/* The tree count is written with a fixed width when streaming
+ * so that it can be patched in place as trees are added */
+#define COUNTWIDTH 10
+
+/* Are the trees grown on samples of each class instead of bootstraps? */
+int subsampled(forest_t* f){
+    return f->rate[0] != 1 || f->rate[1] != 1 || !f->replace;
+}
+
+void writeHeader(forest_t* f, FILE* fp, int width){
+    int i;
+    char* committeename[8];
+    committeename[BAGGING]="Bagging";
+    committeename[BOOSTING]="Boosting";
+    committeename[RANDOMFOREST]="RandomForest";
+    committeename[EXTRATREES]="ExtraTrees";
+
+    fprintf(fp, "committee: %d (%s)\n",f->committee, committeename[f->committee]);
+    fprintf(fp, "trees: ");
+    f->countpos = ftell(fp);
+    fprintf(fp, "%*d\n", width, f->ngrown);
+    fprintf(fp, "features: %d\n", f->nfeat);
+    fprintf(fp, "maxdepth: %d\n", f->maxdepth);
+    fprintf(fp, "fpnfactor: %g\n", f->factor);
+    fprintf(fp, "negweight: %g\n", f->wneg);
+    fprintf(fp, "seed: %u\n", f->seed);
+    if(!f->bootstrap)
+        fprintf(fp, "bootstrap: 0\n");
+    if(subsampled(f)){
+        fprintf(fp, "samplerate: %.9g %.9g\n", f->rate[0], f->rate[1]);
+        fprintf(fp, "replace: %d\n", f->replace);
+    }
+    if(f->compacted)
+        fprintf(fp, "compacted: 1\n");
+    if(f->featid){
+        fprintf(fp, "featureids:");
+        for(i=0; i<f->nfeat; i++)
+            fprintf(fp, " %d", f->featid[i]);
+        fprintf(fp, "\n");
+    }
+}
+
+void writeCount(forest_t* f){
+    fseek(f->out, f->countpos, SEEK_SET);
+    fprintf(f->out, "%*d", COUNTWIDTH, f->ngrown);
+    fseek(f->out, 0, SEEK_END);
+    fflush(f->out);
+}
+
+void appendTree(forest_t* f, node_t* root){
+    startPhase(WRITE);
+    writeTree(f->out, root);
+    freeTree(root);
+    f->ngrown += 1;
+    writeCount(f);
+    stopPhase(WRITE);
+}
+
+/* The temporary file of streamForest holds the trees of the model it
+ * extends, so it can take its place */
+static void replaceModel(forest_t* f){
+    fflush(f->out);
+    if(fsync(fileno(f->out)) != 0 || rename(f->outtemp, f->outname) != 0){
+        fprintf(stderr,"could not replace %s with %s\n",f->outname,f->outtemp);
+        exit(1);
+    }
+    free(f->outname);
+    free(f->outtemp);
+    f->outname = NULL;
+    f->outtemp = NULL;
+}
+
+/* Keep only the first n trees */
+void truncateForest(forest_t* f, int n, long end){
+    int i;
+    if(f->out){
+        fflush(f->out);
+        if(ftruncate(fileno(f->out), end) != 0)
+            fprintf(stderr,"could not truncate the model file\n");
+        f->ngrown = n;
+        writeCount(f);
+    }
+    else{
+        for(i=n; i<f->ngrown; i++)
+            freeTree(f->tree[i]);
+        f->ngrown = n;
+    }
+}
+
+/* Every tree has its own stream of random numbers so that a resumed 
+ * run grows the same trees as an uninterrupted one */
+unsigned int treeSeed(forest_t* f, int t){
+    return f->seed + 2654435761u*(unsigned int)(t+1);
+}
+
+/* cum[i] = examples that rows[0..i] stand for, or NULL if every row is
+ * one example */
+static long* countCopies(const dataset_t* d, const int* rows, int nrows){
+    long* cum;
+    int i;
+    if(d->count == NULL)
+        return NULL;
+    cum = malloc((nrows+1)*sizeof(long));
+    for(i=0; i<nrows; i++)
+        cum[i] = (i ? cum[i-1] : 0) + d->count[rows[i]];
+    return cum;
+}
+
+/* Draw one of the examples of rows and return its row */
+static int drawRow(const int* rows, int nrows, const long* cum, unsigned int* seed){
+    int lo=0,hi=nrows-1,mid;
+    long u = rand_r(seed)%(cum ? cum[nrows-1] : nrows);
+    if(cum == NULL)
+        return rows[u];
+    while(lo < hi){
+        mid = (lo+hi)/2;
+        if(cum[mid] > u)
+            hi = mid;
+        else
+            lo = mid+1;
+    }
+    return rows[lo];
+}
+
+/* Draw a bootstrap sample of the rows into valid and d->weight */
+void bootstrap(tree_t* tree, dataset_t* d, float* w, int* rows, int nrows){
+    int i,r;
+    long* cum = countCopies(d, rows, nrows);
+    long n = cum && nrows ? cum[nrows-1] : nrows;
+    for(i=0; i<d->nex; i++){
+        tree->valid[i]=0;
+        d->weight[i]=0;
+    }
+    for(i=0; i<n; i++){
+        r = drawRow(rows, nrows, cum, &tree->seed);
+        tree->valid[r] = 1;
+        d->weight[r] += w[d->target[r]];
+    }
+    free(cum);
+}
+
+/* Every row once with its class weight, for boosting and trees grown without bootstrap */
+void allRows(tree_t* tree, dataset_t* d, float* w, int* rows, int nrows){
+    int i;
+    for(i=0; i<d->nex; i++){
+        tree->valid[i]=0;
+        d->weight[i]=0;
+    }
+    for(i=0; i<nrows; i++){
+        tree->valid[rows[i]] = 1;
+        d->weight[rows[i]] = w[d->target[rows[i]]]*copies(d, rows[i]);
+    }
+}
+
+/* Draw a fraction f->rate[c] of the examples of each class c, with or
+ * without replacement. Every draw weighs w[c]/f->rate[c] so that the classes
+ * keep the balance they have in the full data. Without replacement the
+ * examples are chosen by selection sampling, which needs no state beyond the
+ * seed. A row that stands for several examples gets the weight of each of
+ * them that is drawn.
+ */
+void sampleClasses(forest_t* f, tree_t* tree, dataset_t* d, float* w, int** rows, int* nrows){
+    int c,i,k,r,m;
+    long n;
+    long* cum;
+    float wc;
+    for(i=0; i<d->nex; i++){
+        tree->valid[i]=0;
+        d->weight[i]=0;
+    }
+    for(c=0; c<2; c++){
+        if(nrows[c] == 0)
+            continue;
+        cum = countCopies(d, rows[c], nrows[c]);
+        n = cum ? cum[nrows[c]-1] : nrows[c];
+        m = (int)(f->rate[c]*n + 0.5);
+        wc = w[c]/f->rate[c];
+        if(f->replace){
+            for(k=0; k<m; k++){
+                r = drawRow(rows[c], nrows[c], cum, &tree->seed);
+                tree->valid[r] = 1;
+                d->weight[r] += wc;
+            }
+        }
+        else{
+            for(i=0; i<nrows[c] && m>0; i++){
+                r = rows[c][i];
+                for(k=copies(d, r); k>0 && m>0; k--, n--){
+                    if(rand_r(&tree->seed)%n >= m)
+                        continue;
+                    tree->valid[r] = 1;
+                    d->weight[r] += wc;
+                    m--;
+                }
+            }
+        }
+        free(cum);
+    }
+}
+
+/* Choose the examples of a tree into tree->valid and d->weight */
+void drawSample(forest_t* f, tree_t* tree, dataset_t* d, float* w, int* rows, int nrows, int** byclass, int* nclass){
+    if(subsampled(f))
+        sampleClasses(f, tree, d, w, byclass, nclass);
+    else if(f->bootstrap)
+        bootstrap(tree, d, w, rows, nrows);
+    else
+        allRows(tree, d, w, rows, nrows);
+}
+
+/* Grow a tree on the examples with valid > 0 only, see subsetData */
+void growSample(tree_t* tree, dataset_t* d){
+    int i,n;
+    dataset_t sub;
+    if(tree->pool)
+        poolSubset(tree->pool, &sub, d, tree->valid);
+    else
+        subsetData(&sub, d, tree->valid);
+    for(n=0, i=0; i<d->nex; i++){
+        if(tree->valid[i] > 0)
+            tree->valid[n++] = tree->valid[i];
+    }
+    tree->colfeat = -1;
+    grow(tree, &sub);
+    freeData(&sub);
+}
+
+/* Update the boosting weights with the predictions of the last tree, which
+ * grow leaves in tree->pred */
+void reweight(tree_t* tree, dataset_t* d){
+    int i;
+    float sum;
+    startPhase(REWEIGHT);
+    sum=0.0f;
+    for(i=0; i<d->nex; i++){
+        d->weight[i]*=exp(-(2*d->target[i]-1)*tree->pred[i]);
+        sum+=d->weight[i];
+    }
+    for(i=0; i<d->nex; i++)
+        d->weight[i]/=sum;
+    stopPhase(REWEIGHT);
+}
+
+/* Grow trees until there are f->ntrees of them. If the forest already has
+ * trees (because it was read from a model) they are replayed first to 
+ * restore the boosting weights and the out of bag estimates.
+ */
 void growForest(forest_t* f, dataset_t* d){
-    int i,t,r;
+    int i,t,resumed,nrows;
+    int* rows;
+    int* byclass[2];
+    int nclass[2];
     tree_t tree;
-    float sum,c[2],w[2];
+    oob_t oob;
+    early_t early;
+    float c[2],w[2];
 
+    if(f->featid == NULL && d->featid != NULL){
+        f->featid = malloc(d->nfeat*sizeof(int));
+        memcpy(f->featid, d->featid, d->nfeat*sizeof(int));
+    }
     f->nfeat = d->nfeat;
-    f->tree = malloc(f->ntrees*sizeof(node_t*));
+    if(!f->out)
+        f->tree = realloc(f->tree, f->ntrees*sizeof(node_t*));
     tree.valid = malloc(d->nex*sizeof(int));
     tree.used = calloc(d->nfeat,sizeof(int));
     tree.feats = malloc(d->nfeat*sizeof(int));
-    for(i=0; i<d->nfeat; i++)
-        tree.feats[i]=i;
     tree.maxdepth = f->maxdepth;
     tree.committee = f->committee;
-    tree.pred = malloc(d->nex*sizeof(float));
+    tree.pred = calloc(d->nex+1,sizeof(float));
+    tree.column = columnBuffer(d);
+    tree.colfeat = -1;
+    tree.hist = malloc(2*MAXBINS*sizeof(float));
+    tree.count = malloc(MAXBINS*sizeof(int));
+    tree.cluster = f->cluster;
+    tree.pool = f->pool;
+    tree.levels = f->levels && !f->cluster && !f->pool;
+
+    /* The rows that can be used for training */
+    rows = malloc(d->nex*sizeof(int));
+    for(nrows=0, i=0; i<d->nex; i++){
+        if(d->use == NULL || d->use[i])
+            rows[nrows++] = i;
+    }
 
     c[0]=c[1]=0;
-    for(i=0; i<d->nex; i++){
-        c[d->target[i]]+=1;
+    for(i=0; i<nrows; i++){
+        c[d->target[rows[i]]]+=copies(d, rows[i]);
     }
+    byclass[0] = malloc(nrows*sizeof(int));
+    byclass[1] = malloc(nrows*sizeof(int));
+    nclass[0] = nclass[1] = 0;
+    for(i=0; i<nrows; i++)
+        byclass[d->target[rows[i]]][nclass[d->target[rows[i]]]++] = rows[i];
     w[0]=f->wneg/(f->wneg*c[0]+c[1]);
     w[1]=1.0/(f->wneg*c[0]+c[1]);
 
-    if (f->committee == BOOSTING){
-        for(i=0; i<d->nex; i++){
-            tree.valid[i]=1;
-            d->weight[i]=w[d->target[i]];
-        }
-    }
-    if(f->oob)
+    if (f->committee == BOOSTING)
+        allRows(&tree, d, w, rows, nrows);
+    if(f->oob){
+        initOOB(&oob, d);
         reportOOBHeader();
-    if(f->committee == RANDOMFOREST)
+    }
+    if(f->validation)
+        initEarly(&early, f->validation, f->ntrees);
+    if(f->committee == RANDOMFOREST || f->committee == EXTRATREES)
         tree.fpn=(int)(f->factor*sqrt(d->nfeat));
     else
         tree.fpn = d->nfeat;
-    for(t=0; t<f->ntrees; t++){
-       // printf("growing tree %d\n",t);
+
+    for(t=0; t<f->ngrown; t++){
+        tree.root = f->tree[t];
         if (f->committee == BOOSTING){
-            grow(&tree, d);
             classifyTrainingData(&tree, tree.root, d);
-            sum=0.0f;
-            for(i=0; i<d->nex; i++){
-                d->weight[i]*=exp(-(2*d->target[i]-1)*tree.pred[i]);
-                sum+=d->weight[i];
-            }
-            for(i=0; i<d->nex; i++)
-                d->weight[i]/=sum;
+            reweight(&tree, d);
+            if(f->validation)
+                updateEarly(&early, tree.root, f->validation, t);
         }
-        else{
-            /* Bootstrap sampling */ 
-            for(i=0; i<d->nex; i++){
-                tree.valid[i]=0;
-                d->weight[i]=0;
-            }
-            for(i=0; i<d->nex; i++){
-                r = rand()%d->nex;
-                tree.valid[r] = 1;
-                d->weight[r] += w[d->target[r]];
-            }
+        else if(f->oob){
+            tree.seed = treeSeed(f, t);
+            drawSample(f, &tree, d, w, rows, nrows, byclass, nclass);
+            updateOOB(&oob, tree.root, d);
+        }
+    }
+    if(f->out){
+        resumed = f->ngrown;
+        f->ngrown = 0;
+        writeHeader(f, f->out, COUNTWIDTH);
+        for(t=0; t<resumed; t++){
+            appendTree(f, f->tree[t]);
+            if(f->validation)
+                early.end[t] = ftell(f->out);
+        }
+        if(f->outtemp)
+            replaceModel(f);
+        free(f->tree);
+        f->tree = NULL;
+    }
+
+    for(t=f->ngrown; t<f->ntrees; t++){
+        tree.seed = treeSeed(f, t);
+        for(i=0; i<d->nfeat; i++)
+            tree.feats[i]=i;
+        if (f->committee == BOOSTING){
+            startPhase(GROW);
             grow(&tree, d);
+            tree.stats.wall = stopPhase(GROW);
+            reweight(&tree, d);
+            if(f->validation)
+                updateEarly(&early, tree.root, f->validation, t);
+        }
+        else{
+            startPhase(GROW);
+            drawSample(f, &tree, d, w, rows, nrows, byclass, nclass);
+            /* Small samples are cheaper to grow from a copy of their own */
+            if(subsampled(f))
+                growSample(&tree, d);
+            else
+                grow(&tree, d);
+            tree.stats.wall = stopPhase(GROW);
             if(f->oob){
-                for(i=0; i<d->nex; i++){
-                    tree.valid[i] = 1;
-                }
-                tabulateOOBVotes(&tree, d);
-                reportOOBError(d, t);
+                updateOOB(&oob, tree.root, d);
+                reportOOBError(&oob, t);
             }
         }
-        f->tree[t] = tree.root;
-        f->ngrown += 1;
+        addTreeStats(&tree.stats);
+        if(f->out){
+            appendTree(f, tree.root);
+            if(f->validation)
+                early.end[t] = ftell(f->out);
+        }
+        else{
+            f->tree[t] = tree.root;
+            f->ngrown += 1;
+        }
+        if(f->validation && f->ngrown - early.best >= f->patience)
+            break;
     }
+    if(f->validation){
+        if(early.best < f->ngrown){
+            printf("Keeping the first %d trees\n", early.best);
+            truncateForest(f, early.best, early.end[early.best-1]);
+        }
+        freeEarly(&early);
+    }
+    if(f->out){
+        fclose(f->out);
+        f->out = NULL;
+    }
+    if(f->oob){
+        if(f->committee != BOOSTING)
+            reportOOBAUC(&oob, d);
+        freeOOB(&oob);
+    }
+    free(rows);
+    free(byclass[0]);
+    free(byclass[1]);
     free(tree.pred);
     free(tree.valid);
     free(tree.used);
     free(tree.feats);
+    free(tree.column);
+    free(tree.hist);
+    free(tree.count);
 }
 
+/* Same as classifyForest for the examples ex[0..n-1] of d, which is stored 
+ * by feature. The prediction for example ex[j] is stored in pred[ex[j]].
+ */
+void classifyExamples(forest_t* f, dataset_t* d, int* ex, int n, float* pred){
+    int i,j;
+    int* mark = calloc(d->nex,sizeof(int));
+    node_t** leaf = malloc(d->nex*sizeof(node_t*));
+    evpair_t* column = columnBuffer(d);
+    for(j=0; j<n; j++)
+        pred[ex[j]] = 0;
+    for(i=0; i<f->ngrown; i++){
+        routeExamples(f->tree[i], d, ex, n, mark, leaf, column);
+        for(j=0; j<n; j++){
+            if(f->committee == BOOSTING)
+                pred[ex[j]] += classifyBoost(leaf[ex[j]], NULL);
+            else
+                pred[ex[j]] += classifyBag(leaf[ex[j]], NULL);
+        }
+    }
+    for(j=0; j<n; j++)
+        pred[ex[j]] /= f->ngrown;
+    free(mark);
+    free(leaf);
+    free(column);
+}
+
+/* The forests classified from here on come from readForest, so the leaves
+ * have their outputs (see setOutputs) */
 float classifyForest(forest_t* f, float* example){
     int i;
     float sum = 0;
-    if(f->committee == BOOSTING){
-        for(i=0; i<f->ngrown; i++){
-            sum += classifyBoost(f->tree[i], example);
+    for(i=0; i<f->ngrown; i++)
+        sum += treeOutput(f->tree[i], example);
+    return sum/f->ngrown;
+}
+
+/* Predictions of the first prefix[j] trees for every j in one pass.
+ * The prefixes must be in increasing order and at most ngrown.
+ */
+void classifyForestPrefixes(forest_t* f, float* example, const int* prefix, int nprefix, float* pred){
+    int i,j;
+    float sum = 0;
+    for(i=0, j=0; j<nprefix; i++){
+        sum += treeOutput(f->tree[i], example);
+        for(; j<nprefix && prefix[j] == i+1; j++)
+            pred[j] = sum/(i+1);
+    }
+}
+
+/* Same as classifyForest but stops as soon as the remaining trees cannot 
+ * change the decision (p > 0 for boosting, p > 0.5 otherwise). In that case
+ * the returned value is the bound on the prediction that is closest to the 
+ * threshold, so it is always on the correct side of it.
+ */
+float classifyForestEarly(forest_t* f, float* example, int* evaluated){
+    int i;
+    float sum = 0;
+    double threshold = f->committee == BOOSTING ? 0 : 0.5*f->ngrown;
+    double lo,hi;
+    for(i=0; i<f->ngrown; i++){
+        sum += treeOutput(f->tree[i], example);
+        lo = sum + f->minrest[i+1] - f->minrest[f->ngrown];
+        hi = sum + f->maxrest[i+1] - f->maxrest[f->ngrown];
+        /* The small slack protects against rounding in the sums */
+        if(lo > threshold + 1e-4 || hi < threshold - 1e-4){
+            *evaluated = i+1;
+            return (lo > threshold ? lo : hi)/f->ngrown;
         }
     }
-    else{
-        for(i=0; i<f->ngrown; i++){
-            sum += classifyBag(f->tree[i], example);
+    *evaluated = f->ngrown;
+    return sum/f->ngrown;
+}
+
+/* Number the features of f as in featid (NULL means 0..nfeat-1), which
+ * must have every feature of f, so that models trained on different data
+ * can read the same example vector */
+void renumberForest(forest_t* f, const int* featid, int nfeat){
+    int i,id;
+    int* map = malloc((f->nfeat+1)*sizeof(int));
+    for(i=0; i<f->nfeat; i++){
+        id = f->featid ? f->featid[i] : i;
+        map[i] = featid ? findFeature(featid, nfeat, id) : id;
+    }
+    for(i=0; i<f->ngrown; i++)
+        renumberTree(f->tree[i], map);
+    free(map);
+    free(f->featid);
+    f->featid = NULL;
+    if(featid){
+        f->featid = malloc(nfeat*sizeof(int));
+        memcpy(f->featid, featid, nfeat*sizeof(int));
+    }
+    f->nfeat = nfeat;
+}
+
+/* Number of nodes the first n trees visit to classify example */
+long nodesVisited(forest_t* f, float* example, int n){
+    int i;
+    long nodes = 0;
+    for(i=0; i<n; i++)
+        nodes += pathLength(f->tree[i], example);
+    return nodes;
+}
+
+/* Most features of a sparse example are zero, and a tree can only leave the
+ * path that the all-zero example takes if the example has a nonzero value
+ * for a feature tested on that path. Store the output of every tree on the
+ * all-zero example and, for every feature, the trees whose all-zero path
+ * tests it. Call it after the last renumberForest and after setting ngrown.
+ */
+void indexForest(forest_t* f){
+    int i,j,n;
+    node_t* t;
+    free(f->zero);
+    free(f->zerosum);
+    free(f->reach);
+    free(f->reachstart);
+    f->zero = malloc((f->ngrown+1)*sizeof(float));
+    f->zerosum = malloc((f->ngrown+1)*sizeof(float));
+    f->reachstart = calloc(f->nfeat+2, sizeof(int));
+    f->zerosum[0] = 0;
+    for(n=0, i=0; i<f->ngrown; i++){
+        for(t=f->tree[i]; t->split >= 0; t = 0 <= t->threshold ? t->left : t->right){
+            f->reachstart[t->split+2]++;
+            n++;
+        }
+        f->zero[i] = t->threshold;
+        f->zerosum[i+1] = f->zerosum[i] + f->zero[i];
+    }
+    for(j=2; j<=f->nfeat+1; j++)
+        f->reachstart[j] += f->reachstart[j-1];
+    /* reachstart[j+1] is where the trees of feature j go while filling */
+    f->reach = malloc((n+1)*sizeof(int));
+    for(i=0; i<f->ngrown; i++){
+        for(t=f->tree[i]; t->split >= 0; t = 0 <= t->threshold ? t->left : t->right)
+            f->reach[f->reachstart[t->split+1]++] = i;
+    }
+}
+
+/* Same as classifyForest for an example whose nonzero features are
+ * active[0..nactive-1]. Only the trees that these features reach are walked
+ * (their number goes to evaluated, and the nodes they visit are added to
+ * nodes if it is not NULL); the others contribute their all-zero output.
+ * The outputs are added in the same order so the result is the same.
+ * mark must have ngrown zeros and is left that way. indexForest must have
+ * been called.
+ */
+float classifyForestSparse(forest_t* f, float* example, const int* active, int nactive, unsigned char* mark, int* evaluated, long* nodes){
+    int i,j,first=f->ngrown;
+    float sum;
+    *evaluated = 0;
+    for(j=0; j<nactive; j++){
+        for(i=f->reachstart[active[j]]; i<f->reachstart[active[j]+1]; i++){
+            mark[f->reach[i]] = 1;
+            first = f->reach[i] < first ? f->reach[i] : first;
+        }
+    }
+    sum = f->zerosum[first];
+    for(i=first; i<f->ngrown; i++){
+        if(mark[i]){
+            sum += treeOutput(f->tree[i], example);
+            if(nodes)
+                *nodes += pathLength(f->tree[i], example);
+            mark[i] = 0;
+            *evaluated += 1;
         }
+        else
+            sum += f->zero[i];
     }
     return sum/f->ngrown;
 }
 
 void writeForest(forest_t* f, const char* fname){
     int i;
-    char* committeename[8];
     FILE* fp = fopen(fname,"w");
     if(fp == NULL){
         fprintf(stderr,"could not write to output file: %s\n",fname);
         return;
     }
-    committeename[BAGGING]="Bagging";
-    committeename[BOOSTING]="Boosting";
-    committeename[RANDOMFOREST]="RandomForest";
-
-    fprintf(fp, "committee: %d (%s)\n",f->committee, committeename[f->committee]);
-    fprintf(fp, "trees: %d\n", f->ngrown);
-    fprintf(fp, "features: %d\n", f->nfeat);
-    fprintf(fp, "maxdepth: %d\n", f->maxdepth);
-    fprintf(fp, "fpnfactor: %g\n", f->factor);
+    startPhase(WRITE);
+    writeHeader(f, fp, 0);
     for(i=0; i<f->ngrown; i++){
         writeTree(fp,f->tree[i]);
     }
     fclose(fp);
+    stopPhase(WRITE);
 }
 
-void readForest(forest_t* f, const char* fname){
+/* Make growForest write each tree to fname and free it as soon as it is
+ * grown. The count in the header is updated after every tree, so the file
+ * is a valid model even if training is interrupted. If f already has trees
+ * (-u), they are written to fname.tmp first, which only replaces fname once
+ * it holds all of them, so the model being extended is never lost.
+ */
+void streamForest(forest_t* f, const char* fname){
+    const char* name = fname;
+    if(f->ngrown > 0){
+        f->outname = malloc(strlen(fname)+1);
+        f->outtemp = malloc(strlen(fname)+5);
+        if(f->outname == NULL || f->outtemp == NULL){
+            fprintf(stderr,"out of memory\n");
+            exit(1);
+        }
+        strcpy(f->outname, fname);
+        sprintf(f->outtemp, "%s.tmp", fname);
+        name = f->outtemp;
+    }
+    f->out = fopen(name,"w");
+    if(f->out == NULL){
+        fprintf(stderr,"could not write to output file: %s\n",name);
+        exit(1);
+    }
+}
+
+
+/* Read the model in fname into f. Returns 0 after a message if the file
+ * cannot be opened or does not hold a whole model, and f then holds nothing
+ * that needs to be freed. */
+int loadForest(forest_t* f, const char* fname){
     int i;
+    char key[32];
     FILE* fp = fopen(fname,"r");
     if(fp == NULL){
         fprintf(stderr,"could not read input file: %s\n",fname);
-        exit(1);
+        return 0;
     }
-    fscanf(fp, "%*s%d%*s",&f->committee);
-    fscanf(fp, "%*s%d", &f->ngrown);
-    fscanf(fp, "%*s%d", &f->nfeat);
-    fscanf(fp, "%*s%d", &f->maxdepth);
-    if(fscanf(fp, "%*s%g", &f->factor)==EOF) {
+    startPhase(READ);
+    if(fscanf(fp, "%*s%d%*s",&f->committee)!=1 ||
+            fscanf(fp, "%*s%d", &f->ngrown)!=1 ||
+            fscanf(fp, "%*s%d", &f->nfeat)!=1 ||
+            fscanf(fp, "%*s%d", &f->maxdepth)!=1 ||
+            fscanf(fp, "%*s%g", &f->factor)!=1 ||
+            f->ngrown < 0 || f->nfeat < 0){
         fprintf(stderr,"corrupt input file: %s\n",fname);
-        exit(1);
+        fclose(fp);
+        stopPhase(READ);
+        return 0;
+    }
+    /* Fields that were added later and may be missing */
+    f->wneg = 1;
+    f->seed = 0;
+    f->bootstrap = 1;
+    f->rate[0] = f->rate[1] = 1;
+    f->replace = 1;
+    f->compacted = 0;
+    f->featid = NULL;
+    while(fscanf(fp, " %31[a-z]:", key)==1){
+        if(strcmp(key,"negweight")==0)
+            fscanf(fp, "%g", &f->wneg);
+        else if(strcmp(key,"seed")==0)
+            fscanf(fp, "%u", &f->seed);
+        else if(strcmp(key,"bootstrap")==0)
+            fscanf(fp, "%d", &f->bootstrap);
+        else if(strcmp(key,"samplerate")==0)
+            fscanf(fp, "%g%g", &f->rate[0], &f->rate[1]);
+        else if(strcmp(key,"replace")==0)
+            fscanf(fp, "%d", &f->replace);
+        else if(strcmp(key,"compacted")==0)
+            fscanf(fp, "%d", &f->compacted);
+        else if(strcmp(key,"featureids")==0){
+            f->featid = malloc(f->nfeat*sizeof(int));
+            for(i=0; i<f->nfeat; i++)
+                fscanf(fp, "%d", &f->featid[i]);
+        }
+        else
+            fscanf(fp, "%*s");
     }
-    f->tree = malloc(sizeof(node_t*)*f->ngrown);
+    f->out = NULL;
+    f->outname = NULL;
+    f->outtemp = NULL;
+    f->levels = 0;
+    f->cluster = NULL;
+    f->pool = NULL;
+    f->validation = NULL;
+    f->patience = 0;
+    f->zero = NULL;
+    f->zerosum = NULL;
+    f->reach = NULL;
+    f->reachstart = NULL;
+    f->minrest = NULL;
+    f->maxrest = NULL;
+    f->tree = malloc(sizeof(node_t*)*(f->ngrown+1));
     for(i=0; i<f->ngrown; i++){
-        readTree(fp,&(f->tree[i]));
+        if(!readTree(fp,&(f->tree[i]),f->nfeat)){
+            fprintf(stderr,"corrupt input file: %s\n",fname);
+            f->ngrown = i;
+            freeForest(f);
+            fclose(fp);
+            stopPhase(READ);
+            return 0;
+        }
+        setOutputs(f->tree[i], f->committee);
+    }
+    /* Precompute the range of the output of the remaining trees for early exit */
+    f->minrest = malloc((f->ngrown+1)*sizeof(double));
+    f->maxrest = malloc((f->ngrown+1)*sizeof(double));
+    f->minrest[f->ngrown] = f->maxrest[f->ngrown] = 0;
+    for(i=f->ngrown-1; i>=0; i--){
+        float lo = FLT_MAX;
+        float hi = -FLT_MAX;
+        outputRange(f->tree[i], f->committee, &lo, &hi);
+        f->minrest[i] = f->minrest[i+1] + lo;
+        f->maxrest[i] = f->maxrest[i+1] + hi;
     }
     if(fscanf(fp, "%*s")!=EOF){
         fprintf(stderr,"garbage at the end of input file: %s\n",fname);
     }
     fclose(fp);
+    stopPhase(READ);
+    return 1;
+}
+
+void readForest(forest_t* f, const char* fname){
+    if(!loadForest(f, fname))
+        exit(1);
 }
 
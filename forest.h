@@ -18,15 +18,46 @@ typedef struct forest_t{
     int committee;
     int oob;
     int nfeat;    /* number of features in the training set */
+    int* featid;  /* id of the ith feature in the input, NULL if it is i */
     int maxdepth; /* maximum depth the tree is allowed to reach */
-    float factor; /* random forest only; how many features to consider */
+    float factor; /* random forests and extra trees; how many features to consider */
     float wneg;   /* relative weight of the negative class */
+    int bootstrap; /* not boosting; grow each tree on a bootstrap sample or on all the data */
+    float rate[2]; /* not boosting; fraction of the negative/positive examples sampled per tree */
+    int replace;  /* sample with replacement? */
+    int levels;   /* grow the trees level by level; the data is read from disk (-m) */
+    int compacted; /* written by festcompact: the leaves only have outputs */
+    unsigned int seed; /* the random numbers of every tree are derived from this */
+    dataset_t* validation; /* boosting only; if not NULL stop when this stops improving */
+    int patience; /* number of trees without improvement before stopping */
+    double* minrest; /* minrest[i] = sum of the smallest outputs of trees i and beyond */
+    double* maxrest; /* maxrest[i] = sum of the largest outputs of trees i and beyond */
+    float* zero;     /* zero[i] = output of tree i when every feature is zero */
+    float* zerosum;  /* zerosum[i] = sum of zero[0..i-1], in the order classifyForest adds */
+    int* reach;      /* reach[reachstart[j]..reachstart[j+1]-1] are the trees whose */
+    int* reachstart; /* all-zero path tests feature j, in increasing order (see indexForest) */
+    FILE* out;    /* if not NULL, trees are written here as they are grown */
+    char* outname; /* if not NULL, out is the temporary file outtemp that */
+    char* outtemp; /* replaces this model once it holds the trees it had */
+    struct cluster_t* cluster; /* if not NULL, the trees are grown with other processes (see cluster.c) */
+    struct pool_t* pool; /* if not NULL, the splits are searched by its threads (see pool.c) */
+    long countpos; /* offset of the tree count in the header of out */
 } forest_t;
 
-void initForest(forest_t* f,int committee, int maxdepth, float param, int trees, float w, int oob);
+void initForest(forest_t* f,int committee, int maxdepth, float param, int trees, float w, int oob, unsigned int seed);
 void freeForest(forest_t* f);
 float classifyForest(forest_t* f, float* example);
+void classifyForestPrefixes(forest_t* f, float* example, const int* prefix, int nprefix, float* pred);
+float classifyForestEarly(forest_t* f, float* example, int* evaluated);
+void indexForest(forest_t* f);
+float classifyForestSparse(forest_t* f, float* example, const int* active, int nactive, unsigned char* mark, int* evaluated, long* nodes);
+long nodesVisited(forest_t* f, float* example, int n);
+void renumberForest(forest_t* f, const int* featid, int nfeat);
+int subsampled(forest_t* f);
 void growForest(forest_t* f, dataset_t* d);
+void classifyExamples(forest_t* f, dataset_t* d, int* ex, int n, float* pred);
+int loadForest(forest_t* f, const char* fname);
 void readForest(forest_t* f, const char* fname);
 void writeForest(forest_t* f, const char* fname);
+void streamForest(forest_t* f, const char* fname);
 #endif /* FOREST_H */
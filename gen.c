@@ -0,0 +1,162 @@
+/***************************************************************************
+ * Author: Nikos Karampatziakis <nk@cs.cornell.edu>, Copyright (C) 2008    *
+ *                                                                         *
+ * Description: Generator of synthetic sparse datasets for benchmarks      *
+ *                                                                         *
+ * License: See LICENSE file that comes with this distribution             *
+ ***************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <getopt.h>
+
+typedef struct gen_t{
+    int nex;
+    int nfeat;
+    float density; /* expected fraction of the features of an example */
+    float binary;  /* fraction of the features that are binary */
+    unsigned int seed;
+}gen_t;
+
+/* A well mixed function of two integers, so that every example and every
+ * feature can be regenerated on its own from the seed */
+static unsigned int mix(unsigned int a, unsigned int b){
+    unsigned int h = a*2654435761u ^ (b+0x9e3779b9u+(a<<6)+(a>>2));
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static float uniform(unsigned int* state){
+    return rand_r(state)/(RAND_MAX+1.0f);
+}
+
+static int isBinary(const gen_t* g, int feat){
+    return mix(g->seed, 2*feat)/4294967296.0 < g->binary;
+}
+
+/* The weight of a feature in the hidden linear model that decides the labels */
+static float weightOf(const gen_t* g, int feat){
+    return mix(g->seed, 2*feat+1)/2147483648.0 - 1;
+}
+
+static int increasing(const void* a, const void* b){
+    return *(const int*)a - *(const int*)b;
+}
+
+/* Features of example i in increasing order and their values. Returns their
+ * number and the score of the hidden model. Popular features have small ids:
+ * an id is nfeat*u^2 for uniform u, so the first few features are dense. */
+static int example(const gen_t* g, int i, int* feat, float* val, float* score){
+    unsigned int state = mix(g->seed ^ 0x5bd1e995u, i);
+    int j,k,n;
+    int mean = g->density*g->nfeat;
+
+    n = 1 + (mean > 0 ? rand_r(&state)%(2*mean) : 0);
+    if(n > g->nfeat)
+        n = g->nfeat;
+    for(j=0; j<n; j++){
+        float u = uniform(&state);
+        feat[j] = 1 + (int)(g->nfeat*u*u);
+    }
+    qsort(feat, n, sizeof(int), increasing);
+    *score = 0;
+    for(k=0, j=0; j<n; j++){
+        if(k > 0 && feat[j] == feat[k-1])
+            continue;
+        feat[k] = feat[j];
+        val[k] = isBinary(g, feat[k]) ? 1 : (int)(1 + 1000*uniform(&state))/100.0f - 5;
+        *score += weightOf(g, feat[k])*val[k];
+        k++;
+    }
+    /* Some noise so that the classes overlap */
+    *score += uniform(&state) - 0.5f;
+    return k;
+}
+
+static int ascending(const void* a, const void* b){
+    float x = *(const float*)a, y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char* argv[]){
+    gen_t g;
+    float pos=0.5;
+    float threshold,score;
+    float* scores;
+    float* val;
+    int* feat;
+    int i,j,n,option;
+    FILE* fp=stdout;
+
+    const char* help="Usage: %s [options] [data]\nWrites a random dataset in SVM-light format to data (default: standard output).\nAvailable options:\n\
+    -b <float>: fraction of the features that are binary (default: 0.5)\n\
+    -d <float>: expected fraction of the features each example has (default: 0.01)\n\
+    -f <int>  : number of features (default: 1000)\n\
+    -n <int>  : number of examples (default: 10000)\n\
+    -p <float>: fraction of positive examples (default: 0.5)\n\
+    -s <int>  : seed, the same seed always gives the same data (default: 1)\n";
+
+    g.nex=10000;
+    g.nfeat=1000;
+    g.density=0.01;
+    g.binary=0.5;
+    g.seed=1;
+    while((option=getopt(argc,argv,"b:d:f:n:p:s:"))!=EOF){
+        switch(option){
+            case 'b': g.binary=atof(optarg); break;
+            case 'd': g.density=atof(optarg); break;
+            case 'f': g.nfeat=atoi(optarg); break;
+            case 'n': g.nex=atoi(optarg); break;
+            case 'p': pos=atof(optarg); break;
+            case 's': g.seed=strtoul(optarg,NULL,10); break;
+            case '?': fprintf(stderr,help,argv[0]); exit(1); break;
+        }
+    }
+    if(g.nex<=0 || g.nfeat<=0 || g.density<0 || g.density>1 || g.binary<0 || g.binary>1 || pos<=0 || pos>=1){
+        fprintf(stderr,"Invalid parameters\n");
+        exit(1);
+    }
+    if(argc - optind > 1){
+        fprintf(stderr,help,argv[0]);
+        exit(1);
+    }
+    if(argc - optind == 1){
+        fp = fopen(argv[optind],"w");
+        if(fp == NULL){
+            fprintf(stderr,"could not write to output file: %s\n",argv[optind]);
+            exit(1);
+        }
+    }
+
+    feat = malloc(2*g.density*g.nfeat*sizeof(int) + sizeof(int));
+    val = malloc(2*g.density*g.nfeat*sizeof(float) + sizeof(float));
+    scores = malloc(g.nex*sizeof(float));
+
+    /* The examples are generated twice: first to find the score above
+     * which a fraction pos of the examples lie, then to write them */
+    for(i=0; i<g.nex; i++)
+        example(&g, i, feat, val, &scores[i]);
+    qsort(scores, g.nex, sizeof(float), ascending);
+    threshold = scores[(int)((1-pos)*g.nex)];
+    for(i=0; i<g.nex; i++){
+        n = example(&g, i, feat, val, &score);
+        fprintf(fp, "%d", score >= threshold ? 1 : -1);
+        for(j=0; j<n; j++){
+            if(val[j] == 1)
+                fprintf(fp, " %d:1", feat[j]);
+            else
+                fprintf(fp, " %d:%.2f", feat[j], val[j]);
+        }
+        fprintf(fp, "\n");
+    }
+    if(fp != stdout)
+        fclose(fp);
+    free(feat);
+    free(val);
+    free(scores);
+    return 0;
+}
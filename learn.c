@@ -9,17 +9,159 @@
 #include "dataset.h"
 #include "tree.h"
 #include "forest.h"
+#include "metrics.h"
+#include "stats.h"
+#include "cluster.h"
+#include "pool.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <getopt.h>
+#include <pthread.h>
 
+/* State shared by the threads that grow the forests of cross validation */
+typedef struct cv_t{
+    forest_t* proto; /* all forests are grown with these parameters */
+    dataset_t* d;
+    int* fold;       /* fold of each example */
+    int k;
+    int next;        /* next fold to be grown */
+    float* pred;     /* out of fold prediction of each example */
+    pthread_mutex_t lock;
+}cv_t;
+
+/* Grow forests on all but one fold and predict the remaining fold 
+ * until there are no folds left */
+void* growFolds(void* arg){
+    cv_t* cv = arg;
+    forest_t f;
+    dataset_t view;
+    int i,j,n;
+    int* heldout = malloc(cv->d->nex*sizeof(int));
+
+    while(1){
+        pthread_mutex_lock(&cv->lock);
+        j = cv->next++;
+        pthread_mutex_unlock(&cv->lock);
+        if(j >= cv->k)
+            break;
+        viewData(&view, cv->d);
+        view.use = malloc(cv->d->nex*sizeof(int));
+        for(n=0, i=0; i<cv->d->nex; i++){
+            view.use[i] = cv->fold[i] != j;
+            if(!view.use[i])
+                heldout[n++] = i;
+        }
+        initForest(&f, cv->proto->committee, cv->proto->maxdepth, cv->proto->factor,
+            cv->proto->ntrees, cv->proto->wneg, 0, cv->proto->seed + j);
+        f.bootstrap = cv->proto->bootstrap;
+        f.rate[0] = cv->proto->rate[0];
+        f.rate[1] = cv->proto->rate[1];
+        f.replace = cv->proto->replace;
+        f.levels = cv->proto->levels;
+        growForest(&f, &view);
+        classifyExamples(&f, &view, heldout, n, cv->pred);
+        freeForest(&f);
+        free(view.use);
+        freeView(&view);
+    }
+    free(heldout);
+    return NULL;
+}
+
+void crossValidate(forest_t* proto, dataset_t* d, int k, int threads, const char* preds){
+    int i,j,n,t;
+    unsigned int seed = proto->seed;
+    float threshold = proto->committee == BOOSTING ? 0 : 0.5;
+    int* perm = malloc(d->nex*sizeof(int));
+    int* target = malloc(d->nex*sizeof(int));
+    float* pred = malloc(d->nex*sizeof(float));
+    pthread_t* thread = malloc(threads*sizeof(pthread_t));
+    cv_t cv;
+    FILE* fp;
+
+    /* Assign the examples to folds at random */
+    for(i=0; i<d->nex; i++)
+        perm[i] = i;
+    for(i=d->nex-1; i>0; i--){
+        j = rand_r(&seed)%(i+1);
+        t = perm[i];
+        perm[i] = perm[j];
+        perm[j] = t;
+    }
+    cv.fold = malloc(d->nex*sizeof(int));
+    for(i=0; i<d->nex; i++)
+        cv.fold[perm[i]] = i%k;
+    cv.proto = proto;
+    cv.d = d;
+    cv.k = k;
+    cv.next = 0;
+    cv.pred = malloc(d->nex*sizeof(float));
+    pthread_mutex_init(&cv.lock, NULL);
+    for(t=0; t<threads; t++)
+        pthread_create(&thread[t], NULL, growFolds, &cv);
+    for(t=0; t<threads; t++)
+        pthread_join(thread[t], NULL);
+
+    printf("%5s  %6s  %6s\n","fold","err","auc");
+    for(j=0; j<k; j++){
+        for(n=0, i=0; i<d->nex; i++){
+            if(cv.fold[i] != j)
+                continue;
+            pred[n] = cv.pred[i];
+            target[n] = d->target[i];
+            n++;
+        }
+        printf("%5d  %5.2f%%  %6.4f\n", j+1, 100*errorRate(pred, target, n, threshold), areaUnderROC(pred, target, n));
+    }
+    printf("%5s  %5.2f%%  %6.4f\n", "all", 100*errorRate(cv.pred, d->target, d->nex, threshold), areaUnderROC(cv.pred, d->target, d->nex));
+
+    if(preds){
+        fp = fopen(preds,"w");
+        if(fp == NULL){
+            fprintf(stderr,"could not write to output file: %s\n",preds);
+            exit(1);
+        }
+        for(i=0; i<d->nex; i++)
+            fprintf(fp,"%f\n",cv.pred[i]);
+        fclose(fp);
+    }
+    pthread_mutex_destroy(&cv.lock);
+    free(cv.fold);
+    free(cv.pred);
+    free(perm);
+    free(target);
+    free(pred);
+    free(thread);
+}
 
 int main(int argc, char* argv[]){
     dataset_t d;
+    dataset_t v;
     forest_t f;
+    cluster_t c;
+    pool_t pool;
     int option;
     int reportoob=0;
+    int resume=0;
+    int patience=10;
+    int folds=0;
+    int pack=0;
+    int all=0;
+    int bind=0;
+    int huge=0;
+    int unique=0;
+    int replace=1;
+    float rate[2]={1,1};
+    char* comma;
+    long memory=0;
+    char* tmpdir=getenv("TMPDIR");
+    int threads=0;
+    char* preds=0;
+    char* stats=0;
+    char* validation=0;
+    char* workers=0;
     int trees=100;
     int maxdepth=1000;
     int committee=2;
@@ -27,33 +169,85 @@ int main(int argc, char* argv[]){
     float w=1.0;
     char* input=0;
     char* model=0;
-    time_t tim;
+    unsigned int seed=time(0);
     
-    const char* help="Usage: %s [options] data model\nAvailable options:\n\
+    const char* help="Usage: %s [options] data model\n       %s -x <int> [options] data\n       %s -g <address>[,<address>...] [options] model\nUse - as data to read the standard input.\nAvailable options:\n\
+    -a        : grow every tree on all the data instead of a bootstrap sample\n\
+                (not for boosting)\n\
+    -b        : bind every thread of -j to a cpu, taking the NUMA nodes in turn\n\
     -c <int>  : committee type:\n\
                 1 bagging\n\
                 2 boosting (default)\n\
                 3 random forest\n\
+                4 extra trees (random thresholds)\n\
     -d <int>  : maximum depth of the trees (default: 1000)\n\
     -e        : report out of bag estimates (default: no)\n\
+    -f <float>[,<float>]: sample this fraction of the examples for each tree;\n\
+                with two values, of the negative and of the positive examples\n\
+                (default: 1, not for boosting)\n\
+    -g <list> : grow the trees with festworker processes listening on these\n\
+                comma separated addresses (host:port or Unix socket path),\n\
+                each holding part of the features of the data\n\
+    -i <file> : write statistics (times of each phase, memory, work done by\n\
+                every tree) to this file as JSON (not for cross validation)\n\
+    -j <int>  : number of threads: with -x, forests grown at once (default: folds),\n\
+                otherwise threads that search for splits, each with its own\n\
+                range of features in memory it touched first (default: 1)\n\
+    -k        : keep one row for the copies of an example with the same label,\n\
+                weighted by their number (not for -m or -x)\n\
+    -l        : ask for transparent huge pages for the columns of -j\n\
+    -m <int>  : out of core: sort the data in runs of this many megabytes and\n\
+                map the sorted columns from a file in $TMPDIR (default: 0 = off)\n\
     -n <float>: relative weight for the negative class (default: 1)\n\
-    -p <float>: parameter for random forests: (default: 1)\n\
+    -o <file> : write the out of fold predictions of cross validation here\n\
+    -p <float>: parameter for random forests and extra trees: (default: 1)\n\
                 (ratio of features considered over sqrt(features))\n\
-    -t <int>  : number of trees (default: 100)\n";
+    -r        : resume: add trees to the model until it has -t trees\n\
+                (-c, -d, -f, -n, -p, -s and -u are taken from the model)\n\
+    -s <int>  : seed for the random number generator (default: time)\n\
+    -t <int>  : number of trees (default: 100)\n\
+    -u        : sample without replacement (default: with replacement)\n\
+    -v <file> : boosting only: stop when the log-loss on this data stops\n\
+                improving and keep the best number of trees\n\
+    -w <int>  : number of trees without improvement before stopping (default: 10)\n\
+    -x <int>  : cross validate with this many folds instead of writing a model\n\
+    -z        : keep the data compressed in memory, slower but smaller (default: no)\n";
     
 
-    while((option=getopt(argc,argv,"c:d:en:p:t:"))!=EOF){
+    while((option=getopt(argc,argv,"abc:d:ef:g:i:j:klm:n:o:p:rs:t:uv:w:x:z"))!=EOF){
         switch(option){
+            case 'a': all=1; break;
+            case 'b': bind=1; break;
             case 'c': committee=atoi(optarg); break;
             case 'd': maxdepth=atoi(optarg); break;
             case 'e': reportoob=1; break;
+            case 'f':
+                rate[0]=rate[1]=atof(optarg);
+                comma=strchr(optarg,',');
+                if(comma)
+                    rate[1]=atof(comma+1);
+                break;
+            case 'g': workers=optarg; break;
+            case 'i': stats=optarg; break;
+            case 'j': threads=atoi(optarg); break;
+            case 'k': unique=1; break;
+            case 'l': huge=1; break;
+            case 'm': memory=atol(optarg); break;
             case 'n': w=atof(optarg); break;
+            case 'o': preds=optarg; break;
             case 'p': param=atof(optarg); break;
+            case 'r': resume=1; break;
+            case 's': seed=strtoul(optarg,NULL,10); break;
             case 't': trees=atoi(optarg); break;
-            case '?': fprintf(stderr,help,argv[0]); exit(1); break;
+            case 'u': replace=0; break;
+            case 'v': validation=optarg; break;
+            case 'w': patience=atoi(optarg); break;
+            case 'x': folds=atoi(optarg); break;
+            case 'z': pack=1; break;
+            case '?': fprintf(stderr,help,argv[0],argv[0],argv[0]); exit(1); break;
         }
     }
-    if(committee!=BAGGING && committee!=BOOSTING && committee!=RANDOMFOREST){
+    if(committee!=BAGGING && committee!=BOOSTING && committee!=RANDOMFOREST && committee!=EXTRATREES){
         fprintf(stderr,"Unknown committee type\n");
         exit(1);
     }
@@ -73,21 +267,143 @@ int main(int argc, char* argv[]){
         fprintf(stderr,"Invalid number of trees\n");
         exit(1);
     }
-    if(argc - optind == 2){
+    if(patience<=0){
+        fprintf(stderr,"Invalid number of trees without improvement\n");
+        exit(1);
+    }
+    if(rate[0]<=0 || rate[1]<=0 || (!replace && (rate[0]>1 || rate[1]>1))){
+        fprintf(stderr,"Invalid sampling rate\n");
+        exit(1);
+    }
+    if(memory<0){
+        fprintf(stderr,"Invalid amount of memory\n");
+        exit(1);
+    }
+    if(folds<0 || folds==1 || threads<0){
+        fprintf(stderr,"Invalid cross validation parameters\n");
+        exit(1);
+    }
+    if(folds && (resume || validation || stats || bind || huge)){
+        fprintf(stderr,"Cross validation cannot be combined with -b, -i, -l, -r or -v\n");
+        exit(1);
+    }
+    if(unique && (folds || memory)){
+        fprintf(stderr,"Merging copies of examples cannot be combined with -m or -x\n");
+        exit(1);
+    }
+    if(!folds && memory && (threads>1 || bind || huge)){
+        fprintf(stderr,"Out of core data cannot be combined with -b, -j or -l\n");
+        exit(1);
+    }
+    if(workers && (folds || resume || validation || reportoob || memory || pack || committee==EXTRATREES || threads || bind || huge || unique)){
+        fprintf(stderr,"Growing with workers cannot be combined with -b, -c 4, -e, -j, -k, -l, -m, -r, -v, -x or -z\n");
+        exit(1);
+    }
+    if(workers && argc - optind == 1){
+        model = argv[optind];
+    }
+    else if(folds && argc - optind == 1){
+        input = argv[optind];
+    }
+    else if(!folds && argc - optind == 2){
         input = argv[optind];
         model = argv[optind+1];
     }
     else{
-        fprintf(stderr,help,argv[0]); 
+        fprintf(stderr,help,argv[0],argv[0],argv[0]); 
         exit(1);
     }
-    tim = time(0);
-    srand(tim);
-    loadData(input,&d);
-    initForest(&f,committee,maxdepth,param,trees,w,reportoob);
+    if(stats)
+        startStats();
+    if(resume){
+        readForest(&f, model);
+        if(f.compacted){
+            fprintf(stderr,"Cannot add trees to a compacted model\n");
+            exit(1);
+        }
+        if(f.ngrown >= trees){
+            fprintf(stderr,"The model already has %d trees\n",f.ngrown);
+            exit(1);
+        }
+        f.ntrees = trees;
+        f.oob = reportoob;
+        seed = f.seed;
+    }
+    else{
+        initForest(&f,committee,maxdepth,param,trees,w,reportoob,seed);
+        f.bootstrap = !all;
+        f.rate[0] = rate[0];
+        f.rate[1] = rate[1];
+        f.replace = replace;
+    }
+    f.levels = memory != 0;
+    if(!f.bootstrap && (f.committee==BOOSTING || f.oob)){
+        fprintf(stderr,"Trees grown on all the data cannot be used with boosting or -e\n");
+        exit(1);
+    }
+    if(subsampled(&f) && (f.committee==BOOSTING || !f.bootstrap)){
+        fprintf(stderr,"Sampling rates cannot be combined with boosting or -a\n");
+        exit(1);
+    }
+    srand(seed);
+    if(workers){
+        /* The workers load the data, here only the features are known */
+        startCluster(&c, &f, &d, workers);
+        streamForest(&f, model);
+        growForest(&f, &d);
+        if(stats)
+            writeStats(stats, "festlearn");
+        stopCluster(&c);
+        freeForest(&f);
+        freeData(&d);
+        return 0;
+    }
+    if(memory)
+        loadDataOnDisk(input,&d,memory<<20,tmpdir ? tmpdir : "/tmp");
+    else if(unique)
+        loadUniqueData(input,&d);
+    else if(pack)
+        loadPackedData(input,&d,1,0);
+    else
+        loadData(input,&d);
+    /* Out of core and merged data are packed once they are loaded */
+    if(pack)
+        packData(&d);
+    if(folds){
+        if(folds > d.nex){
+            fprintf(stderr,"More folds than examples\n");
+            exit(1);
+        }
+        crossValidate(&f, &d, folds, threads ? threads : folds, preds);
+        freeData(&d);
+        return 0;
+    }
+    /* New trees must number the features as the model does */
+    if(resume)
+        alignData(&d, f.featid, f.nfeat);
+    if(validation){
+        if(f.committee!=BOOSTING){
+            fprintf(stderr,"Early stopping is only available for boosting\n");
+            exit(1);
+        }
+        loadData(validation,&v);
+        alignData(&v, d.featid, d.nfeat);
+        f.validation=&v;
+        f.patience=patience;
+    }
+    if(threads>1 || bind || huge){
+        startPool(&pool, &d, threads ? threads : 1, bind, huge);
+        f.pool = &pool;
+    }
+    streamForest(&f, model);
     growForest(&f, &d);
-    writeForest(&f, model);
+    if(f.pool)
+        stopPool(&pool);
+    if(stats)
+        writeStats(stats, "festlearn");
     freeForest(&f);
     freeData(&d);
+    if(validation)
+        freeData(&v);
     return 0;
 }
@@ -0,0 +1,60 @@
+/***************************************************************************
+ * Author: Nikos Karampatziakis <nk@cs.cornell.edu>, Copyright (C) 2008    *
+ *                                                                         *
+ * Description: Functions that evaluate predictions                        *
+ *                                                                         *
+ * License: See LICENSE file that comes with this distribution             *
+ ***************************************************************************/
+
+#include "metrics.h"
+#include <stdlib.h>
+
+typedef struct scored_t{
+    float pred;
+    int target;
+}scored_t;
+
+static int byPrediction(const void* a, const void* b){
+    float x = ((const scored_t*)a)->pred;
+    float y = ((const scored_t*)b)->pred;
+    return x < y ? -1 : x > y;
+}
+
+/* Fraction of examples on the wrong side of the threshold */
+float errorRate(const float* pred, const int* target, int n, float threshold){
+    int i,errors=0;
+    for(i=0; i<n; i++){
+        if((pred[i] > threshold) != (target[i] > 0))
+            errors += 1;
+    }
+    return n > 0 ? (float)errors/n : 0;
+}
+
+/* Area under the ROC curve computed from the ranks of the positive
+ * examples (Mann-Whitney statistic). Tied predictions get their
+ * average rank. */
+float areaUnderROC(const float* pred, const int* target, int n){
+    int i,j,k;
+    double npos=0,ranksum=0;
+    scored_t* s = malloc(n*sizeof(scored_t));
+
+    for(i=0; i<n; i++){
+        s[i].pred = pred[i];
+        s[i].target = target[i] > 0;
+        npos += s[i].target;
+    }
+    qsort(s,n,sizeof(scored_t),byPrediction);
+    for(i=0; i<n; i=j){
+        for(j=i+1; j<n && s[j].pred == s[i].pred; j++)
+            ;
+        /* examples i..j-1 share the ranks i+1..j */
+        for(k=i; k<j; k++){
+            if(s[k].target)
+                ranksum += 0.5*(i+1+j);
+        }
+    }
+    free(s);
+    if(npos == 0 || npos == n)
+        return 0.5;
+    return (ranksum - npos*(npos+1)/2)/(npos*(n-npos));
+}
@@ -0,0 +1,15 @@
+/***************************************************************************
+ * Author: Nikos Karampatziakis <nk@cs.cornell.edu>, Copyright (C) 2008    *
+ *                                                                         *
+ * Description: Declarations of functions that evaluate predictions        *
+ *                                                                         *
+ * License: See LICENSE file that comes with this distribution             *
+ ***************************************************************************/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+float errorRate(const float* pred, const int* target, int n, float threshold);
+float areaUnderROC(const float* pred, const int* target, int n);
+
+#endif /* METRICS_H */
@@ -0,0 +1,291 @@
+/***************************************************************************
+ * Author: Nikos Karampatziakis <nk@cs.cornell.edu>, Copyright (C) 2008    *
+ *                                                                         *
+ * Description: Searching for splits with several threads. Every thread    *
+ *              owns a range of features, whose columns it copies to       *
+ *              memory near the cpu it runs on.                            *
+ *                                                                         *
+ * License: See LICENSE file that comes with this distribution             *
+ ***************************************************************************/
+
+#define _GNU_SOURCE
+#include "pool.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+enum{ PLACE, SCAN, COUNT, FILL, QUIT };
+
+#define HUGEPAGE (2<<20)
+
+/* NUMA node of a cpu, 0 if the system does not say */
+static int cpuNode(int cpu){
+    char name[64];
+    DIR* dir;
+    struct dirent* e;
+    int node = 0;
+    snprintf(name, sizeof(name), "/sys/devices/system/cpu/cpu%d", cpu);
+    dir = opendir(name);
+    if(dir == NULL)
+        return 0;
+    while((e = readdir(dir)) != NULL){
+        if(strncmp(e->d_name, "node", 4) == 0 && sscanf(e->d_name+4, "%d", &node) == 1)
+            break;
+    }
+    closedir(dir);
+    return node;
+}
+
+/* The cpus that the process may use, taking one from each NUMA node in
+ * turn so that a few threads already use the memory of every node */
+static void listCpus(pool_t* p){
+    cpu_set_t set;
+    int i,j,k,n,last;
+    int* node;
+    int* cpu;
+
+    p->ncpus = 0;
+    p->cpus = NULL;
+    if(sched_getaffinity(0, sizeof(set), &set) != 0)
+        return;
+    n = CPU_COUNT(&set);
+    cpu = malloc((n+1)*sizeof(int));
+    node = malloc((n+1)*sizeof(int));
+    for(i=0, k=0; i<CPU_SETSIZE && k<n; i++){
+        if(CPU_ISSET(i, &set)){
+            cpu[k] = i;
+            node[k++] = cpuNode(i);
+        }
+    }
+    for(last=0, i=0; i<k; i++)
+        last = node[i] > last ? node[i] : last;
+    p->cpus = malloc((n+1)*sizeof(int));
+    while(p->ncpus < k){
+        /* One more cpu of every node in each round */
+        for(j=0; j<=last; j++){
+            for(i=0; i<k && node[i] != j; i++)
+                ;
+            if(i < k){
+                p->cpus[p->ncpus++] = cpu[i];
+                node[i] = -1;
+            }
+        }
+    }
+    free(cpu);
+    free(node);
+}
+
+static void bindThread(pool_t* p, int k){
+    cpu_set_t set;
+    helper_t* h = &p->helper[k];
+    h->place.cpu = -1;
+    if(!p->bind || p->ncpus == 0)
+        return;
+    CPU_ZERO(&set);
+    CPU_SET(p->cpus[k%p->ncpus], &set);
+    if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+        h->place.cpu = p->cpus[k%p->ncpus];
+}
+
+/* Copy the columns of thread k to their new storage */
+static void placeColumns(pool_t* p, int k){
+    unsigned int cpu,node;
+    helper_t* h = &p->helper[k];
+    if(syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+        h->place.node = node;
+    else
+        h->place.node = -1;
+    moveColumns(p->d, p->lo[k], p->lo[k+1], p->storage + p->offset[k]);
+}
+
+/* Search the features of thread k for the best split of the current node.
+ * The thread works on a copy of the tree with its own scratch space. */
+static void scanColumns(pool_t* p, int k){
+    helper_t* h = &p->helper[k];
+    tree_t w = *p->tree;
+    w.column = h->column;
+    w.colfeat = -1;
+    w.hist = h->hist;
+    w.count = h->count;
+    memset(&w.stats, 0, sizeof(w.stats));
+    h->best = p->init;
+    scanFeatures(&w, p->root, p->d, p->lo[k], p->lo[k+1], &h->best);
+    h->stats = w.stats;
+    for(h->position=0; h->position<w.fpn; h->position++){
+        if(w.feats[h->position] == h->best.feature)
+            break;
+    }
+}
+
+static void runTask(pool_t* p, int k){
+    helper_t* h = &p->helper[k];
+    if(p->task == PLACE)
+        placeColumns(p, k);
+    else if(p->task == SCAN)
+        scanColumns(p, k);
+    else if(p->task == COUNT)
+        countSubset(p->sub, p->d, p->map, p->lo[k], p->lo[k+1], h->column);
+    else if(p->task == FILL)
+        fillSubset(p->sub, p->d, p->map, p->lo[k], p->lo[k+1], h->column);
+}
+
+static void* member(void* arg){
+    helper_t* h = arg;
+    pool_t* p = h->pool;
+    int k = h - p->helper;
+    bindThread(p, k);
+    while(1){
+        pthread_barrier_wait(&p->start);
+        if(p->task == QUIT)
+            break;
+        runTask(p, k);
+        pthread_barrier_wait(&p->done);
+    }
+    return NULL;
+}
+
+/* The calling thread is thread 0 */
+static void runAll(pool_t* p, int task){
+    p->task = task;
+    if(p->nthreads > 1)
+        pthread_barrier_wait(&p->start);
+    runTask(p, 0);
+    if(p->nthreads > 1)
+        pthread_barrier_wait(&p->done);
+}
+
+/* Split the features of d in nthreads ranges with about the same number of
+ * nonzeros, start the threads and let each one copy its columns */
+void startPool(pool_t* p, dataset_t* d, int nthreads, int bind, int huge){
+    int i,k;
+    long total,sum;
+    size_t bytes;
+    void* storage;
+
+    p->nthreads = nthreads;
+    p->bind = bind;
+    p->huge = huge;
+    listCpus(p);
+    p->lo = malloc((nthreads+1)*sizeof(int));
+    p->offset = malloc((nthreads+1)*sizeof(size_t));
+    p->helper = calloc(nthreads, sizeof(helper_t));
+    for(total=0, i=0; i<d->nfeat; i++)
+        total += d->dense[i] ? d->nex : d->size[i];
+    p->lo[0] = 0;
+    for(sum=0, i=0, k=1; k<nthreads; k++){
+        for(; i<d->nfeat && sum*nthreads < k*total; i++)
+            sum += d->dense[i] ? d->nex : d->size[i];
+        p->lo[k] = i;
+    }
+    p->lo[nthreads] = d->nfeat;
+    for(k=0; k<nthreads; k++){
+        helper_t* h = &p->helper[k];
+        h->pool = p;
+        h->column = columnBuffer(d);
+        h->hist = malloc(2*MAXBINS*sizeof(float));
+        h->count = malloc(MAXBINS*sizeof(int));
+        h->place.features = p->lo[k+1] - p->lo[k];
+        for(i=p->lo[k]; i<p->lo[k+1]; i++)
+            h->place.nonzeros += d->dense[i] ? d->nex : d->size[i];
+        p->offset[k] = columnBytes(d, 0, p->lo[k]);
+        h->place.bytes = columnBytes(d, p->lo[k], p->lo[k+1]);
+        /* and the bins of its dense features */
+        for(i=p->lo[k]; i<p->lo[k+1]; i++)
+            h->place.bytes += d->dense[i] ? d->nex : 0;
+    }
+    bytes = columnBytes(d, 0, d->nfeat);
+
+    /* The storage is not touched here, so each page of it ends up on the
+     * node of the thread that writes it first */
+    if(posix_memalign(&storage, huge ? HUGEPAGE : sysconf(_SC_PAGESIZE), bytes+1) != 0){
+        fprintf(stderr,"Could not allocate memory for the columns\n");
+        exit(1);
+    }
+    p->storage = storage;
+#ifdef MADV_HUGEPAGE
+    if(huge && bytes >= HUGEPAGE && madvise(storage, bytes/HUGEPAGE*HUGEPAGE, MADV_HUGEPAGE) == 0){
+        for(k=0; k<nthreads; k++)
+            p->helper[k].place.hugepages = 1;
+    }
+#endif
+
+    pthread_barrier_init(&p->start, NULL, nthreads);
+    pthread_barrier_init(&p->done, NULL, nthreads);
+    bindThread(p, 0);
+    for(k=1; k<nthreads; k++)
+        pthread_create(&p->helper[k].thread, NULL, member, &p->helper[k]);
+    p->d = d;
+    runAll(p, PLACE);
+    setStorage(d, storage);
+    for(k=0; k<nthreads; k++)
+        addPlacement(&p->helper[k].place);
+}
+
+/* The best split of root over the features of all the threads. It is the
+ * one bestSplit would find: ties go to the earliest feature of t->feats. */
+void poolSplit(pool_t* p, tree_t* t, node_t* root, dataset_t* d, split_t* ret){
+    int k,tried,improved,position=-1;
+    helper_t* h;
+
+    p->tree = t;
+    p->root = root;
+    p->d = d;
+    p->init = *ret;
+    runAll(p, SCAN);
+    tried = ret->tried;
+    improved = ret->improved;
+    for(k=0; k<p->nthreads; k++){
+        h = &p->helper[k];
+        t->stats.features += h->stats.features;
+        t->stats.nonzeros += h->stats.nonzeros;
+        tried += h->best.tried;
+        improved += h->best.improved;
+        if(h->best.feature < 0)
+            continue;
+        if(ret->feature < 0 || h->best.gain > ret->gain ||
+                (h->best.gain == ret->gain && h->position < position)){
+            *ret = h->best;
+            position = h->position;
+        }
+    }
+    ret->tried = tried;
+    ret->improved = improved;
+}
+
+/* Same as subsetData, but every thread copies the columns of its own
+ * features, so that the sample is also near the threads that scan it */
+void poolSubset(pool_t* p, dataset_t* sub, dataset_t* d, const int* keep){
+    p->d = d;
+    p->sub = sub;
+    p->map = subsetRows(sub, d, keep);
+    runAll(p, COUNT);
+    allocSubset(sub);
+    runAll(p, FILL);
+    free(p->map);
+    p->map = NULL;
+}
+
+void stopPool(pool_t* p){
+    int k;
+    p->task = QUIT;
+    if(p->nthreads > 1)
+        pthread_barrier_wait(&p->start);
+    for(k=1; k<p->nthreads; k++)
+        pthread_join(p->helper[k].thread, NULL);
+    pthread_barrier_destroy(&p->start);
+    pthread_barrier_destroy(&p->done);
+    for(k=0; k<p->nthreads; k++){
+        free(p->helper[k].column);
+        free(p->helper[k].hist);
+        free(p->helper[k].count);
+    }
+    free(p->helper);
+    free(p->lo);
+    free(p->offset);
+    free(p->cpus);
+}
@@ -0,0 +1,60 @@
+/***************************************************************************
+ * Author: Nikos Karampatziakis <nk@cs.cornell.edu>, Copyright (C) 2008    *
+ *                                                                         *
+ * Description: Declarations for searching for splits with several threads *
+ *                                                                         *
+ * License: See LICENSE file that comes with this distribution             *
+ ***************************************************************************/
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+#include "dataset.h"
+#include "tree.h"
+#include "stats.h"
+
+/* What a thread of the pool has of its own */
+typedef struct helper_t{
+    struct pool_t* pool;
+    pthread_t thread;
+    evpair_t* column; /* as in tree_t */
+    float* hist;
+    int* count;
+    treestats_t stats; /* of the last search */
+    split_t best;      /* best split of the last search */
+    int position;      /* of its feature in tree->feats */
+    placement_t place;
+}helper_t;
+
+/* Threads that each own a range of features: thread k scans the features
+ * lo[k]..lo[k+1]-1 of every node, and its columns are in memory that it
+ * touched first, which the operating system places on its NUMA node. */
+typedef struct pool_t{
+    int nthreads;
+    int* lo;
+    helper_t* helper;
+    pthread_barrier_t start; /* the threads wait here for a task */
+    pthread_barrier_t done;  /* and here when they finish it */
+    int task;
+    int bind;     /* pin thread k to the kth cpu that the process may use */
+    int huge;     /* ask for transparent huge pages for the columns */
+    int* cpus;
+    int ncpus;
+    /* The current task */
+    tree_t* tree;
+    node_t* root;
+    dataset_t* d;
+    split_t init;
+    dataset_t* sub;         /* the sample being copied from d */
+    int* map;               /* see subsetRows */
+    unsigned char* storage; /* the new storage of the columns */
+    size_t* offset;         /* where the columns of thread k go in it */
+}pool_t;
+
+void startPool(pool_t* p, dataset_t* d, int nthreads, int bind, int huge);
+void poolSplit(pool_t* p, tree_t* t, node_t* root, dataset_t* d, split_t* ret);
+void poolSubset(pool_t* p, dataset_t* sub, dataset_t* d, const int* keep);
+void stopPool(pool_t* p);
+
+#endif /* POOL_H */
@@ -0,0 +1,189 @@
+/***************************************************************************
+ * Author: Nikos Karampatziakis <nk@cs.cornell.edu>, Copyright (C) 2008    *
+ *                                                                         *
+ * Description: Client and load generator for festserve.                   *
+ *                                                                         *
+ * License: See LICENSE file that comes with this distribution             *
+ ***************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+typedef struct client_t{
+    double* latency; /* seconds spent on each request */
+    int nreq;
+    FILE* preds; /* where to write the replies, if anywhere */
+}client_t;
+
+static char** lines;
+static int nlines;
+static int batch=100;
+static int passes=1;
+static const char* sockname;
+
+double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+void readLines(const char* name){
+    FILE* fp;
+    char* line = 0;
+    size_t cap = 0;
+    int size = 1024;
+
+    fp = fopen(name,"r");
+    if(fp == NULL){
+        fprintf(stderr,"Could not open file %s\n",name);
+        exit(1);
+    }
+    lines = malloc(size*sizeof(char*));
+    nlines = 0;
+    while(getline(&line,&cap,fp) != -1){
+        /* An empty line would end the batch early */
+        if(line[strspn(line," \t\r\n")] == '\0')
+            continue;
+        if(nlines == size){
+            size *= 2;
+            lines = realloc(lines,size*sizeof(char*));
+        }
+        lines[nlines++] = strdup(line);
+    }
+    free(line);
+    fclose(fp);
+}
+
+void* client(void* arg){
+    client_t* c = arg;
+    struct sockaddr_un addr;
+    char* line = 0;
+    size_t cap = 0;
+    int fd,p,i,j;
+    double start;
+    FILE* in;
+    FILE* out;
+
+    memset(&addr,0,sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path,sockname,sizeof(addr.sun_path)-1);
+    fd = socket(AF_UNIX,SOCK_STREAM,0);
+    if(fd < 0 || connect(fd,(struct sockaddr*)&addr,sizeof(addr)) < 0){
+        fprintf(stderr,"Could not connect to %s\n",sockname);
+        exit(1);
+    }
+    in = fdopen(fd,"r");
+    out = fdopen(dup(fd),"w");
+    c->nreq = 0;
+    c->latency = malloc(passes*((nlines+batch-1)/batch)*sizeof(double));
+    for(p=0; p<passes; p++){
+        for(i=0; i<nlines; i+=batch){
+            start = now();
+            for(j=i; j<i+batch && j<nlines; j++)
+                fputs(lines[j],out);
+            fputs("\n",out);
+            fflush(out);
+            while(getline(&line,&cap,in) != -1 && line[0] != '\n'){
+                if(c->preds && p == 0)
+                    fputs(line,c->preds);
+            }
+            c->latency[c->nreq++] = now() - start;
+        }
+    }
+    free(line);
+    fclose(in);
+    fclose(out);
+    return NULL;
+}
+
+int cmp(const void* a, const void* b){
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char* argv[]){
+    int i,j,n,option;
+    int clients=1;
+    double start,elapsed,sum;
+    double* all;
+    client_t* c;
+    pthread_t* thread;
+    FILE* preds=0;
+
+    const char* help="Usage: %s [options] socket data [predictions]\nAvailable options:\n\
+    -b <int>  : examples per request (default: 100)\n\
+    -c <int>  : number of concurrent connections (default: 1)\n\
+    -n <int>  : passes over the data per connection (default: 1)\n";
+
+    while((option=getopt(argc,argv,"b:c:n:"))!=EOF){
+        switch(option){
+            case 'b': batch=atoi(optarg); break;
+            case 'c': clients=atoi(optarg); break;
+            case 'n': passes=atoi(optarg); break;
+            case '?': fprintf(stderr,help,argv[0]); exit(1); break;
+        }
+    }
+    if(batch <= 0 || clients <= 0 || passes <= 0){
+        fprintf(stderr,"Invalid option value\n");
+        exit(1);
+    }
+    if(argc - optind != 2 && argc - optind != 3){
+        fprintf(stderr,help,argv[0]);
+        exit(1);
+    }
+    sockname = argv[optind];
+    readLines(argv[optind+1]);
+    if(argc - optind == 3){
+        preds = fopen(argv[optind+2],"w");
+        if(preds == NULL){
+            fprintf(stderr,"Could not open predictions file\n");
+            exit(1);
+        }
+    }
+
+    c = calloc(clients,sizeof(client_t));
+    thread = malloc(clients*sizeof(pthread_t));
+    /* Only the first connection writes its replies */
+    c[0].preds = preds;
+    start = now();
+    for(i=0; i<clients; i++)
+        pthread_create(&thread[i],NULL,client,&c[i]);
+    for(i=0; i<clients; i++)
+        pthread_join(thread[i],NULL);
+    elapsed = now() - start;
+
+    for(n=0, i=0; i<clients; i++)
+        n += c[i].nreq;
+    all = malloc(n*sizeof(double));
+    sum = 0;
+    for(n=0, i=0; i<clients; i++){
+        for(j=0; j<c[i].nreq; j++){
+            all[n++] = c[i].latency[j];
+            sum += c[i].latency[j];
+        }
+        free(c[i].latency);
+    }
+    qsort(all,n,sizeof(double),cmp);
+    printf("requests: %d\n",n);
+    printf("examples/sec: %.0f\n",(double)clients*passes*nlines/elapsed);
+    if(n > 0){
+        printf("latency mean: %.3f ms\n",1e3*sum/n);
+        printf("latency p50: %.3f ms\n",1e3*all[(int)(0.50*(n-1))]);
+        printf("latency p99: %.3f ms\n",1e3*all[(int)(0.99*(n-1))]);
+        printf("latency max: %.3f ms\n",1e3*all[n-1]);
+    }
+    if(preds)
+        fclose(preds);
+    free(all);
+    free(c);
+    free(thread);
+    return 0;
+}
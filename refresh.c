@@ -0,0 +1,231 @@
+/***************************************************************************
+ * Author: Nikos Karampatziakis <nk@cs.cornell.edu>, Copyright (C) 2008    *
+ *                                                                         *
+ * Description: Refresh module. Recomputes the statistics in the leaves of *
+ *              a model from new data, keeping the splits of the trees.    *
+ *                                                                         *
+ * License: See LICENSE file that comes with this distribution             *
+ ***************************************************************************/
+
+#include "dataset.h"
+#include "tree.h"
+#include "forest.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <float.h>
+#include <getopt.h>
+#include <pthread.h>
+
+/* Scratch space of one thread */
+typedef struct route_t{
+    int* ex;         /* the examples, in the order routeExamples leaves them */
+    int* mark;       /* scratch space for routeExamples */
+    evpair_t* column;/* scratch space for routeExamples */
+    node_t** leaf;   /* leaf reached by each example */
+    node_t** leaves; /* the leaves of the current tree */
+    float* old;      /* their masses before the refresh, pos and neg */
+    int size;        /* room in leaves and old */
+}route_t;
+
+/* State shared by the threads that refresh the trees */
+typedef struct refresh_t{
+    forest_t* f;
+    dataset_t* d;
+    float keep;      /* fraction of the old masses that is kept */
+    int next;        /* next tree to be refreshed */
+    pthread_mutex_t lock;
+}refresh_t;
+
+void initRoute(route_t* r, dataset_t* d){
+    int i;
+    r->ex = malloc(d->nex*sizeof(int));
+    for(i=0; i<d->nex; i++)
+        r->ex[i] = i;
+    r->mark = calloc(d->nex,sizeof(int));
+    r->column = columnBuffer(d);
+    r->leaf = malloc(d->nex*sizeof(node_t*));
+    r->size = 64;
+    r->leaves = malloc(r->size*sizeof(node_t*));
+    r->old = malloc(2*r->size*sizeof(float));
+}
+
+void freeRoute(route_t* r){
+    free(r->ex);
+    free(r->mark);
+    free(r->column);
+    free(r->leaf);
+    free(r->leaves);
+    free(r->old);
+}
+
+/* Collect the leaves below t, remember their masses and clear them */
+int clearLeaves(node_t* t, route_t* r, int n){
+    if(t->split >= 0){
+        n = clearLeaves(t->left, r, n);
+        return clearLeaves(t->right, r, n);
+    }
+    if(n == r->size){
+        r->size *= 2;
+        r->leaves = realloc(r->leaves, r->size*sizeof(node_t*));
+        r->old = realloc(r->old, 2*r->size*sizeof(float));
+    }
+    r->leaves[n] = t;
+    r->old[2*n] = t->pos;
+    r->old[2*n+1] = t->neg;
+    t->pos = t->neg = 0;
+    return n+1;
+}
+
+/* Send the examples of d down the tree with their weights and replace the
+ * masses of its leaves by keep*old + (1-keep)*new. A leaf that no example
+ * reaches keeps its old masses. Like in grow, the new masses of a leaf are
+ * fractions of the total weight, so they are on the scale of the old ones.
+ */
+void refreshTree(node_t* root, dataset_t* d, float keep, route_t* r){
+    int i,x,n;
+    n = clearLeaves(root, r, 0);
+    routeExamples(root, d, r->ex, d->nex, r->mark, r->leaf, r->column);
+    for(i=0; i<d->nex; i++){
+        x = r->ex[i];
+        if(d->target[x])
+            r->leaf[x]->pos += d->weight[x];
+        else
+            r->leaf[x]->neg += d->weight[x];
+    }
+    for(i=0; i<n; i++){
+        if(r->leaves[i]->pos == 0 && r->leaves[i]->neg == 0){
+            r->leaves[i]->pos = r->old[2*i];
+            r->leaves[i]->neg = r->old[2*i+1];
+            continue;
+        }
+        r->leaves[i]->pos = keep*r->old[2*i] + (1-keep)*fmaxf(FLT_EPSILON, r->leaves[i]->pos);
+        r->leaves[i]->neg = keep*r->old[2*i+1] + (1-keep)*fmaxf(FLT_EPSILON, r->leaves[i]->neg);
+    }
+}
+
+/* The trees of bagging, random forests and extra trees are independent,
+ * so every thread refreshes the next tree that nobody has taken yet */
+void* refreshTrees(void* arg){
+    refresh_t* rf = arg;
+    route_t r;
+    int t;
+
+    initRoute(&r, rf->d);
+    while(1){
+        pthread_mutex_lock(&rf->lock);
+        t = rf->next++;
+        pthread_mutex_unlock(&rf->lock);
+        if(t >= rf->f->ngrown)
+            break;
+        refreshTree(rf->f->tree[t], rf->d, rf->keep, &r);
+    }
+    freeRoute(&r);
+    return NULL;
+}
+
+/* Every tree of boosting is fit to the weights left by the trees before it,
+ * so the trees are refreshed in order and the weights updated after each
+ * one, as in growForest */
+void refreshBoosting(forest_t* f, dataset_t* d, float keep){
+    route_t r;
+    int i,t;
+    float sum;
+
+    initRoute(&r, d);
+    for(t=0; t<f->ngrown; t++){
+        refreshTree(f->tree[t], d, keep, &r);
+        sum = 0;
+        for(i=0; i<d->nex; i++){
+            d->weight[i] *= exp(-(2*d->target[i]-1)*classifyBoost(r.leaf[i], NULL));
+            sum += d->weight[i];
+        }
+        for(i=0; i<d->nex; i++)
+            d->weight[i] /= sum;
+    }
+    freeRoute(&r);
+}
+
+int main(int argc, char* argv[]){
+    dataset_t d;
+    forest_t f;
+    refresh_t rf;
+    pthread_t* thread;
+    int i,option;
+    int c[2];
+    float w[2];
+    int threads=4;
+    int pack=0;
+    float keep=0;
+
+    const char* help="Usage: %s [options] data model newmodel\nUse - as data to read the standard input.\nAvailable options:\n\
+    -j <int>  : number of threads, not for boosting (default: 4)\n\
+    -k <float>: fraction of the old statistics of each leaf to keep, the rest\n\
+                comes from the new data (default: 0 = recompute)\n\
+    -z        : keep the data compressed in memory, slower but smaller (default: no)\n";
+
+    while((option=getopt(argc,argv,"j:k:z"))!=EOF){
+        switch(option){
+            case 'j': threads=atoi(optarg); break;
+            case 'k': keep=atof(optarg); break;
+            case 'z': pack=1; break;
+            case '?': fprintf(stderr,help,argv[0]); exit(1); break;
+        }
+    }
+    if(threads<=0){
+        fprintf(stderr,"Invalid number of threads\n");
+        exit(1);
+    }
+    if(keep<0 || keep>=1){
+        fprintf(stderr,"Invalid fraction of the old statistics\n");
+        exit(1);
+    }
+    if(argc - optind != 3){
+        fprintf(stderr,help,argv[0]);
+        exit(1);
+    }
+    readForest(&f, argv[optind+1]);
+    if(f.compacted){
+        fprintf(stderr,"The leaves of a compacted model have no statistics to refresh\n");
+        exit(1);
+    }
+    loadData(argv[optind], &d);
+    if(pack)
+        packData(&d);
+    /* The splits refer to the features of the training data */
+    alignData(&d, f.featid, f.nfeat);
+    if(d.nex == 0){
+        fprintf(stderr,"No examples in %s\n",argv[optind]);
+        exit(1);
+    }
+
+    /* Every example gets the weight of its class, like in growForest */
+    c[0] = c[1] = 0;
+    for(i=0; i<d.nex; i++)
+        c[d.target[i]] += 1;
+    w[0] = f.wneg/(f.wneg*c[0]+c[1]);
+    w[1] = 1.0/(f.wneg*c[0]+c[1]);
+    for(i=0; i<d.nex; i++)
+        d.weight[i] = w[d.target[i]];
+
+    if(f.committee == BOOSTING)
+        refreshBoosting(&f, &d, keep);
+    else{
+        rf.f = &f;
+        rf.d = &d;
+        rf.keep = keep;
+        rf.next = 0;
+        pthread_mutex_init(&rf.lock, NULL);
+        thread = malloc(threads*sizeof(pthread_t));
+        for(i=0; i<threads; i++)
+            pthread_create(&thread[i], NULL, refreshTrees, &rf);
+        for(i=0; i<threads; i++)
+            pthread_join(thread[i], NULL);
+        pthread_mutex_destroy(&rf.lock);
+        free(thread);
+    }
+    writeForest(&f, argv[optind+2]);
+    freeForest(&f);
+    freeData(&d);
+    return 0;
+}
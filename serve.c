@@ -0,0 +1,376 @@
+/***************************************************************************
+ * Author: Nikos Karampatziakis <nk@cs.cornell.edu>, Copyright (C) 2008    *
+ *                                                                         *
+ * Description: Scoring daemon. Loads models once and answers batches of   *
+ *              examples over a Unix domain socket or stdin/stdout.        *
+ *                                                                         *
+ * License: See LICENSE file that comes with this distribution             *
+ ***************************************************************************/
+
+#include "dataset.h"
+#include "tree.h"
+#include "forest.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* The models currently being served. Every batch holds a reference to the
+ * set it started with, so a reload never frees models that are in use.
+ */
+typedef struct modelset_t{
+    forest_t* forest;
+    int nmodels;
+    int maxfeat; /* largest number of features over all models */
+    int refs;
+}modelset_t;
+
+static modelset_t* current;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static char** modelname;
+static int nmodels;
+static int listenfd = -1;
+static const char* sockname = 0;
+
+/* Read all the models, or return NULL if any of them cannot be read */
+modelset_t* loadModels(){
+    int i;
+    modelset_t* m = malloc(sizeof(modelset_t));
+
+    m->forest = malloc(nmodels*sizeof(forest_t));
+    m->nmodels = nmodels;
+    m->maxfeat = 1;
+    m->refs = 1; /* This is the reference held by current */
+    for(i=0; i<nmodels; i++){
+        if(!loadForest(&m->forest[i], modelname[i])){
+            while(--i >= 0)
+                freeForest(&m->forest[i]);
+            free(m->forest);
+            free(m);
+            return NULL;
+        }
+        if(m->forest[i].nfeat > m->maxfeat)
+            m->maxfeat = m->forest[i].nfeat;
+    }
+    return m;
+}
+
+modelset_t* acquireModels(){
+    modelset_t* m;
+    pthread_mutex_lock(&lock);
+    m = current;
+    m->refs += 1;
+    pthread_mutex_unlock(&lock);
+    return m;
+}
+
+void releaseModels(modelset_t* m){
+    int i,refs;
+    pthread_mutex_lock(&lock);
+    refs = --m->refs;
+    pthread_mutex_unlock(&lock);
+    if(refs > 0)
+        return;
+    for(i=0; i<m->nmodels; i++)
+        freeForest(&m->forest[i]);
+    free(m->forest);
+    free(m);
+}
+
+/* The new models replace the old ones only if all of them can be read. A
+ * model that is missing, or truncated because it is still being written,
+ * leaves the old models in service. */
+void reloadModels(){
+    modelset_t* old;
+    modelset_t* fresh;
+
+    fresh = loadModels();
+    if(fresh == NULL){
+        fprintf(stderr,"keeping the old models\n");
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    old = current;
+    current = fresh;
+    pthread_mutex_unlock(&lock);
+    releaseModels(old);
+    fprintf(stderr,"reloaded %d model(s)\n",nmodels);
+}
+
+static int blank(const char* line){
+    return line[strspn(line," \t\r\n")] == '\0';
+}
+
+/* Lines of a batch that a scoring thread takes at a time */
+#define CHUNK 16
+
+/* A batch of lines being scored. The scoring threads take its lines CHUNK
+ * at a time, so even a single client keeps all of them busy. */
+typedef struct batch_t{
+    char** line;
+    int n;
+    modelset_t* m;
+    float* pred;   /* pred[i*m->nmodels+j] is the output of model j for line i */
+    int* scored;   /* number of models that gave an output for line i */
+    int next;      /* first line that no thread has taken */
+    int done;      /* lines that are scored */
+    pthread_cond_t finished;
+    struct batch_t* link; /* next batch in the queue */
+}batch_t;
+
+/* Batches with lines that no thread has taken yet, oldest first */
+static batch_t* head = NULL;
+static batch_t* tail = NULL;
+static pthread_mutex_t qlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+
+/* The models may number the features differently, so each of them parses
+ * the line into example, which has room for m->maxfeat features */
+static void scoreLines(batch_t* b, int lo, int hi, float* example){
+    int i,j,target;
+    for(i=lo; i<hi; i++){
+        for(j=0; j<b->m->nmodels; j++){
+            if(!parseExample(b->line[i],example,b->m->forest[j].nfeat,b->m->forest[j].featid,&target))
+                break;
+            b->pred[i*b->m->nmodels+j] = classifyForest(&b->m->forest[j],example);
+        }
+        b->scored[i] = j;
+    }
+}
+
+void* scorer(void* arg){
+    batch_t* b;
+    float* example = 0;
+    int lo,hi,cap = 0;
+    (void)arg;
+
+    while(1){
+        pthread_mutex_lock(&qlock);
+        while(head == NULL)
+            pthread_cond_wait(&work,&qlock);
+        b = head;
+        lo = b->next;
+        hi = lo+CHUNK < b->n ? lo+CHUNK : b->n;
+        b->next = hi;
+        if(hi == b->n){
+            head = b->link;
+            if(head == NULL)
+                tail = NULL;
+        }
+        pthread_mutex_unlock(&qlock);
+        if(cap < b->m->maxfeat){
+            cap = b->m->maxfeat;
+            example = realloc(example,cap*sizeof(float));
+        }
+        scoreLines(b,lo,hi,example);
+        pthread_mutex_lock(&qlock);
+        b->done += hi-lo;
+        if(b->done == b->n)
+            pthread_cond_signal(&b->finished);
+        pthread_mutex_unlock(&qlock);
+    }
+    return NULL;
+}
+
+/* Queue the lines of b and wait until the scoring threads are done */
+static void scoreBatch(batch_t* b){
+    b->pred = malloc(b->n*b->m->nmodels*sizeof(float));
+    b->scored = malloc(b->n*sizeof(int));
+    b->next = 0;
+    b->done = 0;
+    b->link = NULL;
+    pthread_cond_init(&b->finished,NULL);
+    pthread_mutex_lock(&qlock);
+    if(tail)
+        tail->link = b;
+    else
+        head = b;
+    tail = b;
+    pthread_cond_broadcast(&work);
+    while(b->done < b->n)
+        pthread_cond_wait(&b->finished,&qlock);
+    pthread_mutex_unlock(&qlock);
+    pthread_cond_destroy(&b->finished);
+}
+
+/* Answer batches until the input ends. A batch is a sequence of lines in
+ * SVM-light format terminated by an empty line. The reply contains one line
+ * per example with the prediction of each model, followed by an empty line.
+ * The whole batch is read before it is scored by the scoring threads, and
+ * the reply is written in the order of the lines once all of them are
+ * scored, so a client which writes the whole batch before reading can never
+ * deadlock with us.
+ */
+void serve(FILE* in, FILE* out){
+    char* line = 0;
+    size_t cap = 0;
+    int i,j,size = 0,pending;
+    batch_t b;
+
+    b.line = 0;
+    b.n = 0;
+    b.m = 0;
+    for(pending=1; pending; ){
+        pending = getline(&line,&cap,in) != -1;
+        if(!pending || blank(line)){
+            if(b.m == 0 && !pending)
+                break;
+            if(b.m != 0){
+                scoreBatch(&b);
+                for(i=0; i<b.n; i++){
+                    for(j=0; j<b.scored[i]; j++)
+                        fprintf(out,j ? " %f" : "%f",b.pred[i*b.m->nmodels+j]);
+                    if(j > 0)
+                        fprintf(out,"\n");
+                    free(b.line[i]);
+                }
+                releaseModels(b.m);
+                free(b.pred);
+                free(b.scored);
+                b.m = 0;
+                b.n = 0;
+            }
+            fprintf(out,"\n");
+            fflush(out);
+            continue;
+        }
+        if(b.m == 0)
+            b.m = acquireModels();
+        if(b.n == size){
+            size = size ? 2*size : 64;
+            b.line = realloc(b.line,size*sizeof(char*));
+        }
+        b.line[b.n++] = line;
+        line = 0;
+        cap = 0;
+    }
+    free(b.line);
+    free(line);
+}
+
+/* Serves one connection at a time */
+void* connection(void* arg){
+    int fd;
+    FILE* in;
+    FILE* out;
+    (void)arg;
+
+    while(1){
+        fd = accept(listenfd,NULL,NULL);
+        if(fd < 0){
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+            perror("accept");
+            exit(1);
+        }
+        in = fdopen(fd,"r");
+        out = fdopen(dup(fd),"w");
+        serve(in,out);
+        fclose(in);
+        fclose(out);
+    }
+    return NULL;
+}
+
+/* All signals are delivered here, the other threads have them blocked */
+void* signals(void* arg){
+    sigset_t* set = arg;
+    int sig;
+
+    while(sigwait(set,&sig) == 0){
+        if(sig == SIGHUP)
+            reloadModels();
+        else
+            break;
+    }
+    if(sockname)
+        unlink(sockname);
+    exit(0);
+    return NULL;
+}
+
+int openSocket(const char* name){
+    struct sockaddr_un addr;
+    int fd;
+
+    if(strlen(name) >= sizeof(addr.sun_path)){
+        fprintf(stderr,"Socket name too long: %s\n",name);
+        exit(1);
+    }
+    memset(&addr,0,sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path,name);
+    unlink(name);
+    fd = socket(AF_UNIX,SOCK_STREAM,0);
+    if(fd < 0 || bind(fd,(struct sockaddr*)&addr,sizeof(addr)) < 0 || listen(fd,64) < 0){
+        fprintf(stderr,"Could not listen on socket %s\n",name);
+        exit(1);
+    }
+    return fd;
+}
+
+int main(int argc, char* argv[]){
+    int i,option;
+    int workers=4;
+    sigset_t set;
+    pthread_t sigthread;
+    pthread_t* pool;
+    pthread_t* clients;
+
+    const char* help="Usage: %s [options] model [model ...]\nAvailable options:\n\
+    -j <int>  : number of threads that score the examples, and of connections\n\
+                served at once (default: 4)\n\
+    -s <path> : listen on this Unix domain socket (default: stdin/stdout)\n";
+
+    while((option=getopt(argc,argv,"j:s:"))!=EOF){
+        switch(option){
+            case 'j': workers=atoi(optarg); break;
+            case 's': sockname=optarg; break;
+            case '?': fprintf(stderr,help,argv[0]); exit(1); break;
+        }
+    }
+    if(workers <= 0){
+        fprintf(stderr,"Invalid number of workers\n");
+        exit(1);
+    }
+    if(argc - optind < 1){
+        fprintf(stderr,help,argv[0]);
+        exit(1);
+    }
+    modelname = argv + optind;
+    nmodels = argc - optind;
+    current = loadModels();
+    if(current == NULL)
+        exit(1);
+
+    /* Clients that go away should not kill the server */
+    signal(SIGPIPE,SIG_IGN);
+    sigemptyset(&set);
+    sigaddset(&set,SIGHUP);
+    sigaddset(&set,SIGINT);
+    sigaddset(&set,SIGTERM);
+    pthread_sigmask(SIG_BLOCK,&set,NULL);
+    pthread_create(&sigthread,NULL,signals,&set);
+
+    /* Every batch, from stdin or from a connection, is scored by the pool */
+    pool = malloc(workers*sizeof(pthread_t));
+    for(i=0; i<workers; i++)
+        pthread_create(&pool[i],NULL,scorer,NULL);
+    if(sockname == 0){
+        serve(stdin,stdout);
+        return 0;
+    }
+    listenfd = openSocket(sockname);
+    clients = malloc(workers*sizeof(pthread_t));
+    for(i=0; i<workers; i++)
+        pthread_create(&clients[i],NULL,connection,NULL);
+    for(i=0; i<workers; i++)
+        pthread_join(clients[i],NULL);
+    return 0;
+}
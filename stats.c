@@ -0,0 +1,167 @@
+/***************************************************************************
+ * Author: Nikos Karampatziakis <nk@cs.cornell.edu>, Copyright (C) 2008    *
+ *                                                                         *
+ * Description: Timing of the phases of a run and counters of the work     *
+ *              done by every tree, written as JSON                        *
+ *                                                                         *
+ * License: See LICENSE file that comes with this distribution             *
+ ***************************************************************************/
+
+#include "stats.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+/* The phases are accumulated in globals, so only one thread may grow or
+ * classify while the statistics are on. The counters of a tree live in its
+ * tree_t and are always kept, since they cost a few additions per node. */
+int statsOn = 0;
+
+typedef struct phase_t{
+    long calls;
+    double wall;
+    double cpu;
+    int timedcpu;   /* was cpu measured? Phases that are too short are not */
+    double start[2];
+}phase_t;
+
+static const char* phasename[NPHASES] = {"parse", "sort", "index", "pack", "grow",
+    "split", "sweep", "reweight", "oob", "validate", "write", "read", "classify"};
+static phase_t phase[NPHASES];
+static double started;
+static treestats_t* tree;
+static int ntrees;
+static long examples;
+static long treesvisited;
+static long nodesvisited;
+static placement_t* place;
+static int nplaced;
+
+double wallClock(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+static double cpuClock(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+void startStats(void){
+    statsOn = 1;
+    started = wallClock();
+}
+
+void startPhase(int p){
+    if(!statsOn)
+        return;
+    phase[p].start[0] = wallClock();
+    phase[p].start[1] = cpuClock();
+}
+
+/* Returns the wall time since startPhase */
+double stopPhase(int p){
+    double wall;
+    if(!statsOn)
+        return 0;
+    wall = wallClock() - phase[p].start[0];
+    phase[p].wall += wall;
+    phase[p].cpu += cpuClock() - phase[p].start[1];
+    phase[p].timedcpu = 1;
+    phase[p].calls += 1;
+    return wall;
+}
+
+/* For phases that are timed by the caller, with wallClock only */
+void addPhase(int p, double seconds){
+    if(!statsOn)
+        return;
+    phase[p].wall += seconds;
+    phase[p].calls += 1;
+}
+
+void addTreeStats(const treestats_t* s){
+    if(!statsOn)
+        return;
+    tree = realloc(tree, (ntrees+1)*sizeof(treestats_t));
+    tree[ntrees++] = *s;
+    phase[SPLIT].wall += s->split;
+    phase[SPLIT].calls += s->nodes - s->leaves;
+    phase[SWEEP].wall += s->sweep;
+    phase[SWEEP].calls += s->nodes - s->leaves;
+}
+
+void addClassifyStats(long n, long trees, long nodes){
+    examples += n;
+    treesvisited += trees;
+    nodesvisited += nodes;
+}
+
+void addPlacement(const placement_t* p){
+    if(!statsOn)
+        return;
+    place = realloc(place, (nplaced+1)*sizeof(placement_t));
+    place[nplaced++] = *p;
+}
+
+void writeStats(const char* fname, const char* program){
+    int i,first;
+    struct rusage ru;
+    double wall = wallClock() - started;
+    FILE* fp = fopen(fname,"w");
+    if(fp == NULL){
+        fprintf(stderr,"could not write to output file: %s\n",fname);
+        exit(1);
+    }
+    getrusage(RUSAGE_SELF, &ru);
+    fprintf(fp, "{\n  \"program\": \"%s\",\n", program);
+    fprintf(fp, "  \"wall\": %.6f,\n", wall);
+    fprintf(fp, "  \"cpu\": %.6f,\n", ru.ru_utime.tv_sec + 1e-6*ru.ru_utime.tv_usec + ru.ru_stime.tv_sec + 1e-6*ru.ru_stime.tv_usec);
+    fprintf(fp, "  \"peak_rss_kb\": %ld,\n", ru.ru_maxrss);
+    fprintf(fp, "  \"phases\": {");
+    for(first=1, i=0; i<NPHASES; i++){
+        if(phase[i].calls == 0)
+            continue;
+        fprintf(fp, "%s\n    \"%s\": {\"calls\": %ld, \"wall\": %.6f", first ? "" : ",", phasename[i], phase[i].calls, phase[i].wall);
+        if(phase[i].timedcpu)
+            fprintf(fp, ", \"cpu\": %.6f", phase[i].cpu);
+        fprintf(fp, "}");
+        first = 0;
+    }
+    fprintf(fp, "\n  }");
+    if(examples > 0){
+        fprintf(fp, ",\n  \"classify\": {\"examples\": %ld, \"trees_per_example\": %.3f, \"nodes_per_example\": %.3f, \"examples_per_second\": %.1f}",
+            examples, (double)treesvisited/examples, (double)nodesvisited/examples,
+            phase[CLASSIFY].wall > 0 ? examples/phase[CLASSIFY].wall : 0);
+    }
+    if(ntrees > 0){
+        fprintf(fp, ",\n  \"trees\": [");
+        for(i=0; i<ntrees; i++){
+            fprintf(fp, "%s\n    {\"nodes\": %d, \"leaves\": %d, \"depth\": %d, \"features\": %ld, \"nonzeros\": %ld, "
+                "\"thresholds\": %ld, \"updates\": %ld, \"swept\": %ld, \"split\": %.6f, \"sweep\": %.6f, \"wall\": %.6f}",
+                i ? "," : "", tree[i].nodes, tree[i].leaves, tree[i].depth, tree[i].features, tree[i].nonzeros,
+                tree[i].thresholds, tree[i].updates, tree[i].swept, tree[i].split, tree[i].sweep, tree[i].wall);
+        }
+        fprintf(fp, "\n  ]");
+    }
+    if(nplaced > 0){
+        fprintf(fp, ",\n  \"placement\": [");
+        for(i=0; i<nplaced; i++){
+            fprintf(fp, "%s\n    {\"thread\": %d, \"cpu\": %d, \"node\": %d, \"features\": %d, \"nonzeros\": %ld, \"bytes\": %ld, \"huge_pages\": %d}",
+                i ? "," : "", i, place[i].cpu, place[i].node, place[i].features, place[i].nonzeros, place[i].bytes, place[i].hugepages);
+        }
+        fprintf(fp, "\n  ]");
+    }
+    fprintf(fp, "\n}\n");
+    fclose(fp);
+    free(place);
+    place = NULL;
+    nplaced = 0;
+    free(tree);
+    tree = NULL;
+    ntrees = 0;
+}
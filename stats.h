@@ -0,0 +1,68 @@
+/***************************************************************************
+ * Author: Nikos Karampatziakis <nk@cs.cornell.edu>, Copyright (C) 2008    *
+ *                                                                         *
+ * Description: Declarations for timing the phases of a run and counting   *
+ *              the work done by every tree                                *
+ *                                                                         *
+ * License: See LICENSE file that comes with this distribution             *
+ ***************************************************************************/
+
+#ifndef STATS_H
+#define STATS_H
+
+/* Phases of a run. Nothing is timed unless startStats was called. */
+enum{
+    PARSE,    /* reading and parsing the examples */
+    SORT,     /* sorting the pairs into columns */
+    INDEX,    /* renumbering the features and building the columns */
+    PACK,     /* compressing the columns */
+    GROW,     /* growing trees, which includes SPLIT and SWEEP */
+    SPLIT,    /* bestSplit, wall time only */
+    SWEEP,    /* updating valid[] after a split, wall time only */
+    REWEIGHT, /* boosting: classifying the training data with the new tree */
+    OOB,      /* out of bag estimates */
+    VALIDATE, /* early stopping on the validation data */
+    WRITE,    /* writing trees */
+    READ,     /* reading a model */
+    CLASSIFY, /* classifying examples, wall time only */
+    NPHASES
+};
+
+/* Work done while growing one tree */
+typedef struct treestats_t{
+    int nodes;
+    int leaves;
+    int depth;       /* of the deepest leaf, the root is at depth 0 */
+    long features;   /* features scanned by bestSplit */
+    long nonzeros;   /* pairs (or examples of dense features) scanned by bestSplit */
+    long thresholds; /* candidate thresholds evaluated, i.e. calls to updateSplit */
+    long updates;    /* calls to updateSplit that found a better split */
+    long swept;      /* entries of valid[] updated after the splits */
+    double split;    /* seconds in bestSplit */
+    double sweep;    /* seconds updating valid[] */
+    double wall;     /* seconds to grow the tree */
+}treestats_t;
+
+/* Where a thread that searches for splits ran and the columns it scans */
+typedef struct placement_t{
+    int cpu;         /* -1 if the thread was not bound to one */
+    int node;        /* NUMA node of the cpu */
+    int features;
+    long nonzeros;
+    long bytes;      /* of its columns, in memory it touched first */
+    int hugepages;   /* were transparent huge pages asked for? */
+}placement_t;
+
+extern int statsOn;
+
+void startStats(void);
+double wallClock(void);
+void startPhase(int phase);
+double stopPhase(int phase);
+void addPhase(int phase, double seconds);
+void addTreeStats(const treestats_t* s);
+void addClassifyStats(long examples, long trees, long nodes);
+void addPlacement(const placement_t* p);
+void writeStats(const char* fname, const char* program);
+
+#endif /* STATS_H */
@@ -7,17 +7,20 @@
  ***************************************************************************/
 
 #include "tree.h"
+#include "cluster.h"
+#include "pool.h"
 #include "dataset.h"
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
+#include <string.h>
 #include <float.h>
 
 #define EPS 1e-6 /* Smoothing constant */
 
 /* generate random subset of k elements that are not used */
-void randomSubset(int* ss, int n, int k, int* used){
+void randomSubset(int* ss, int n, int k, int* used, unsigned int* seed){
     int selected=0;
     int r,t,i,sum=0;
     for(i=0; i<n; i++)
@@ -25,7 +28,7 @@ void randomSubset(int* ss, int n, int k, int* used){
     if(sum>n-k)
         return;
     do{
-        r = selected + rand() % (n-selected);
+        r = selected + rand_r(seed) % (n-selected);
         if(used[r])
             continue;
         t = ss[r];
@@ -76,7 +79,9 @@ static void updateSplit(int feature, float threshold, float posleft, float negle
     float sizeright = posright+negright;
     float total = node->pos+node->neg;
     float gain = -(sizeleft/total*entropy(posleft/sizeleft)+sizeright/total*entropy(posright/sizeright));
+    split->tried += 1;
     if (gain > split->gain){
+        split->improved += 1;
         split->gain = gain;
         split->feature = feature;
         split->threshold = threshold;
@@ -87,26 +92,203 @@ static void updateSplit(int feature, float threshold, float posleft, float negle
     }
 }
 
-/* Find the best split for node root along with other relevant information */
-split_t bestSplit(tree_t* t, node_t* root, dataset_t* d){
-    split_t ret;
+/* The pairs of feature i. Packed data is decoded into the scratch space 
+ * of the tree, unless that already holds feature i. */
+static evpair_t* treeColumn(tree_t* t, dataset_t* d, int i){
+    if(d->packed == NULL)
+        return d->feature[i];
+    if(t->colfeat != i){
+        getColumn(d, i, t->column);
+        t->colfeat = i;
+    }
+    return t->column;
+}
+
+/* A threshold drawn uniformly between the smallest and the largest value at
+ * a node. If some valid examples of the node lack the feature (zeros is
+ * not 0), their value 0 is in the range too.
+ */
+static float randomThreshold(tree_t* t, float lo, float hi, int zeros){
+    double u = (rand_r(&t->seed) + 0.5) / ((double)RAND_MAX + 1);
+    if(zeros){
+        lo = min(lo, 0);
+        hi = max(hi, 0);
+    }
+    return lo + u*(hi - lo);
+}
+
+/* Extra trees: evaluate a single random threshold of the continuous
+ * feature i, whose pairs are fi */
+static void randomSplit(tree_t* t, node_t* root, dataset_t* d, int i, evpair_t* fi, split_t* ret){
+    int j,ex,lo,hi,n;
+    float threshold,posleft,negleft,posnonzero,negnonzero;
+
+    /* The pairs are sorted so the extreme values are the first and last valid ones */
+    for(lo=0; lo<d->size[i] && t->valid[fi[lo].example]<=0; lo++)
+        ;
+    if(lo == d->size[i])
+        return;
+    for(hi=d->size[i]-1; t->valid[fi[hi].example]<=0; hi--)
+        ;
+    for(n=0, j=lo; j<=hi; j++)
+        n += t->valid[fi[j].example]>0;
+    threshold = randomThreshold(t, fi[lo].value, fi[hi].value, n < t->nvalid);
+    if(threshold == 0)
+        return;
+    posleft = negleft = FLT_EPSILON;
+    posnonzero = negnonzero = FLT_EPSILON;
+    for(j=lo; j<=hi; j++){
+        ex = fi[j].example;
+        if(t->valid[ex]<=0)
+            continue;
+        if(d->target[ex]){
+            posnonzero += d->weight[ex];
+            if(fi[j].value <= threshold)
+                posleft += d->weight[ex];
+        }
+        else{
+            negnonzero += d->weight[ex];
+            if(fi[j].value <= threshold)
+                negleft += d->weight[ex];
+        }
+    }
+    /* The examples without the feature go left if the threshold is positive */
+    if(threshold > 0){
+        posleft += max(FLT_EPSILON, root->pos - posnonzero);
+        negleft += max(FLT_EPSILON, root->neg - negnonzero);
+    }
+    updateSplit(i,threshold,posleft,negleft,root,ret);
+}
+
+/* Same as the search in bestSplit for a dense feature. The mass in every 
+ * bin is collected in one pass over the examples, then the bins are visited
+ * in the order of their values, which gives the same candidate thresholds.
+ */
+static void denseSplit(tree_t* t, node_t* root, dataset_t* d, int i, split_t* ret){
+    dense_t* dn = d->dense[i];
+    float* pos = t->hist;
+    float* neg = t->hist + MAXBINS;
+    int* count = t->count;
+    int h,ex,prev,last;
+    float posleft,negleft,poszero,negzero,posnonzero,negnonzero;
+
+    if(!d->cont[i]){ /* The feature is binary, 1 is the last value */
+        float posright = 0;
+        float negright = 0;
+        h = dn->nbins-1;
+        for(ex=0; ex<d->nex; ex++){
+            if(t->valid[ex]<=0 || dn->bin[ex] != h)
+                continue;
+            if(d->target[ex])
+                posright += d->weight[ex];
+            else
+                negright += d->weight[ex];
+        }
+        posleft = max(FLT_EPSILON, root->pos - posright);
+        negleft = max(FLT_EPSILON, root->neg - negright);
+        updateSplit(i,0.5,posleft,negleft,root,ret);
+        return;
+    }
+    for(h=0; h<dn->nbins; h++){
+        pos[h] = neg[h] = 0;
+        count[h] = 0;
+    }
+    for(ex=0; ex<d->nex; ex++){
+        if(t->valid[ex]<=0)
+            continue;
+        h = dn->bin[ex];
+        count[h] += 1;
+        if(d->target[ex])
+            pos[h] += d->weight[ex];
+        else
+            neg[h] += d->weight[ex];
+    }
+    /* Find the first valid nonzero value */
+    for(prev=0; prev<dn->nbins; prev++){
+        if(prev != dn->zero && count[prev] > 0)
+            break;
+    }
+    if(prev == dn->nbins)
+        return;
+    posnonzero = FLT_EPSILON;
+    negnonzero = FLT_EPSILON;
+    for(h=prev; h<dn->nbins; h++){
+        if(h == dn->zero)
+            continue;
+        posnonzero += pos[h];
+        negnonzero += neg[h];
+    }
+    poszero = max(FLT_EPSILON, root->pos - posnonzero);
+    negzero = max(FLT_EPSILON, root->neg - negnonzero);
+    posleft = FLT_EPSILON;
+    negleft = FLT_EPSILON;
+    if(t->committee == EXTRATREES){
+        float threshold;
+        for(last=dn->nbins-1; last == dn->zero || count[last] == 0; last--)
+            ;
+        threshold = randomThreshold(t, dn->value[prev], dn->value[last], dn->zero >= 0 && count[dn->zero] > 0);
+        if(threshold == 0)
+            return;
+        for(h=prev; h<=last && dn->value[h] <= threshold; h++){
+            if(h == dn->zero)
+                continue;
+            posleft += pos[h];
+            negleft += neg[h];
+        }
+        if(threshold > 0){
+            posleft += poszero;
+            negleft += negzero;
+        }
+        updateSplit(i,threshold,posleft,negleft,root,ret);
+        return;
+    }
+    if (dn->value[prev] > 0){
+        posleft += poszero;
+        negleft += negzero;
+        updateSplit(i,0.5*dn->value[prev],posleft,negleft,root,ret);
+    }
+    for(h=prev+1; h<dn->nbins; h++){
+        if(h == dn->zero || count[h] == 0)
+            continue;
+        posleft += pos[prev];
+        negleft += neg[prev];
+        if (dn->value[prev] < 0 && 0 < dn->value[h]){
+            updateSplit(i,0.5*dn->value[prev],posleft,negleft,root,ret);
+            posleft += poszero;
+            negleft += negzero;
+            updateSplit(i,0.5*dn->value[h],posleft,negleft,root,ret);
+        }
+        updateSplit(i,0.5*(dn->value[h] + dn->value[prev]),posleft,negleft,root,ret);
+        prev = h;
+    }
+}
+
+/* Look for a split of root better than ret among the features of t->feats
+ * that are in lo..hi-1 */
+void scanFeatures(tree_t* t, node_t* root, dataset_t* d, int lo, int hi, split_t* best){
+    split_t ret = *best;
     int ii,i,j,ex,prev,prevex;
     float posleft,negleft,poszero,negzero,posnonzero,negnonzero;
     float threshold;
-    float total = root->pos+root->neg;
     evpair_t* fi;
 
-    ret.feature = -1;
-    /* First compute the entropy of the parent */
-    ret.gain = -entropy(root->pos/total);
-    /* Select random subset of features */
-    if(t->committee == RANDOMFOREST)
-        randomSubset(t->feats, d->nfeat, t->fpn, t->used);
     for(ii=0; ii<t->fpn; ii++){
         i=t->feats[ii];
-        if(t->used[i])
+        /* A feature without pairs cannot split the node. The samples of
+         * subsetData and the processes of a cluster have such features. */
+        if(i<lo || i>=hi || t->used[i] || (d->size[i]==0 && !d->dense[i]))
+            continue;
+        t->stats.features += 1;
+        t->stats.nonzeros += d->dense[i] ? d->nex : d->size[i];
+        if(d->dense[i]){
+            denseSplit(t,root,d,i,&ret);
             continue;
-        fi=d->feature[i];
+        }
+        fi=treeColumn(t,d,i);
+        if(d->cont[i] && t->committee == EXTRATREES){
+            randomSplit(t,root,d,i,fi,&ret);
+            continue;
+        }
         if(d->cont[i]){ /* If the feature is continuous */
             /* Find the first valid example */
             prevex = -1;
@@ -201,31 +383,165 @@ split_t bestSplit(tree_t* t, node_t* root, dataset_t* d){
             updateSplit(i,0.5,posleft,negleft,root,&ret);
         }
     }
+    *best = ret;
+}
+
+/* Find the best split for node root along with other relevant information */
+split_t bestSplit(tree_t* t, node_t* root, dataset_t* d){
+    split_t ret;
+    float total = root->pos+root->neg;
+
+    ret.feature = -1;
+    ret.tried = ret.improved = 0;
+    /* First compute the entropy of the parent */
+    ret.gain = -entropy(root->pos/total);
+    /* Select random subset of features */
+    if(t->committee == RANDOMFOREST || t->committee == EXTRATREES)
+        randomSubset(t->feats, d->nfeat, t->fpn, t->used, &t->seed);
+    if(t->committee == EXTRATREES){
+        int i;
+        for(t->nvalid=0, i=0; i<d->nex; i++)
+            t->nvalid += t->valid[i]>0;
+    }
+    /* The random thresholds of extra trees are drawn in the order of the
+     * features, so they are searched by one thread */
+    if(t->pool && t->committee != EXTRATREES)
+        poolSplit(t->pool, t, root, d, &ret);
+    else
+        scanFeatures(t, root, d, 0, d->nfeat, &ret);
+    t->stats.thresholds += ret.tried;
+    t->stats.updates += ret.improved;
     return ret;
 }
 
 
+/* The pairs b[*l..*u-1] of a feature with size pairs are the ones that a 
+ * split at threshold separates from the examples where the feature is zero:
+ * the values > threshold if threshold > 0, the values <= threshold otherwise.
+ */
+static void splitRange(evpair_t* b, int size, float threshold, int* l, int* u){
+    int i,k=0,m=size;
+    /* Find the first example whose value exceeds the threshold */
+    while (k < m) {
+        i = (k + m)/2;
+        if (b[i].value > threshold)
+            m = i;
+        else
+            k = i + 1;
+    }
+    *l = threshold > 0 ? k : 0;
+    *u = threshold > 0 ? size : k;
+}
+
+/* Which values of a dense feature splitRange would select */
+static void splitBins(dense_t* dn, float threshold, unsigned char* sel){
+    int h;
+    for(h=0; h<dn->nbins; h++){
+        if(threshold > 0)
+            sel[h] = dn->value[h] > threshold;
+        else
+            sel[h] = dn->value[h] != 0 && dn->value[h] <= threshold;
+    }
+}
+
+/* The valid examples selected by splitRange, which the processes of a
+ * cluster that do not have feature f need to follow the split. Returns
+ * their number. Shifting only the valid examples is enough, since the
+ * others stay invalid on both sides of the split. */
+int markSplit(tree_t* t, dataset_t* d, int f, float threshold, int* ex){
+    int i,l,u,n=0;
+    evpair_t* b;
+    unsigned char sel[MAXBINS];
+
+    if(d->dense[f]){
+        splitBins(d->dense[f], threshold, sel);
+        for(i=0; i<d->nex; i++){
+            if(t->valid[i]>0 && sel[d->dense[f]->bin[i]])
+                ex[n++]=i;
+        }
+        return n;
+    }
+    b = treeColumn(t,d,f);
+    splitRange(b, d->size[f], threshold, &l, &u);
+    for(i=l; i<u; i++){
+        if(t->valid[b[i].example]>0)
+            ex[n++]=b[i].example;
+    }
+    return n;
+}
+
+/* Add delta to valid[x] for every example x selected by splitRange */
+static void shiftValid(tree_t* t, dataset_t* d, int f, float threshold, int delta){
+    int i,l,u;
+    evpair_t* b;
+    int* ex;
+    unsigned char sel[MAXBINS];
+
+    if(t->cluster){
+        u = splitExamples(t->cluster, &ex);
+        for(i=0; i<u; i++)
+            t->valid[ex[i]]+=delta;
+        t->stats.swept += u;
+        return;
+    }
+    if(d->dense[f]){
+        splitBins(d->dense[f], threshold, sel);
+        for(i=0; i<d->nex; i++)
+            t->valid[i]+=sel[d->dense[f]->bin[i]]*delta;
+        t->stats.swept += d->nex;
+        return;
+    }
+    b = treeColumn(t,d,f);
+    splitRange(b, d->size[f], threshold, &l, &u);
+    for(i=l; i<u; i++)
+        t->valid[b[i].example]+=delta;
+    t->stats.swept += u-l;
+}
+
+/* Make root a leaf. With boosting its valid examples also get its output,
+ * so reweight does not have to classify the training data again. */
+static void stopGrowing(tree_t* t, node_t* root, dataset_t* d){
+    int i;
+    float pred;
+    root->split=-1;
+    t->stats.leaves += 1;
+    if(t->committee != BOOSTING)
+        return;
+    pred=0.5f*logf((root->pos+EPS)/(root->neg+EPS));
+    for(i=0; i<d->nex; i++){
+        if(t->valid[i]>0)
+            t->pred[i] = pred;
+    }
+}
+
 void growrec(tree_t* t, node_t* root, dataset_t* d, int depth){
     split_t best;
-    int i,k,l,u;
+    int i;
     node_t* first;
     node_t* second;
-    evpair_t* b;
+    double start=0;
 
+    t->stats.nodes += 1;
+    if(depth > t->stats.depth)
+        t->stats.depth = depth;
     /* Stop if max depth is reached or node is pure */
     if(depth>=t->maxdepth || root->pos <= FLT_EPSILON || root->neg <= FLT_EPSILON){
-        root->split=-1;
+        stopGrowing(t, root, d);
         return;
     }
 
     /* Find the best split */
-    best = bestSplit(t,root,d);
+    if(statsOn)
+        start = wallClock();
+    best = t->cluster ? clusterSplit(t,root,d) : bestSplit(t,root,d);
+    if(statsOn)
+        t->stats.split += wallClock() - start;
 
     /* Stop if no good split is left or the counts in one of the children are very small */
     if (best.feature < 0 || 
             (best.posleft <= FLT_EPSILON && best.negleft <= FLT_EPSILON) || 
             (best.posright <= FLT_EPSILON && best.negright <= FLT_EPSILON)){
-        root->split=-1;
+        stopGrowing(t, root, d);
         return;
     }
 
@@ -242,26 +558,11 @@ void growrec(tree_t* t, node_t* root, dataset_t* d, int depth){
     /* Mark the feature as used */
     if(!d->cont[best.feature])
         t->used[best.feature]=1;
-    b = d->feature[best.feature];
-    /* Find the first example whose value exceeds the threshold */
-    k = 0;
-    u = d->size[best.feature];
-    while (k < u) {
-        i = (k + u)/2;
-        if (b[i].value > best.threshold)
-            u = i;
-        else
-            k = i + 1;
-    }
     if (best.threshold > 0){
-        l=k;
-        u=d->size[best.feature];
         first = root->left;
         second = root->right;
     }
     else{
-        l=0;
-        u=k;
         first = root->right;
         second = root->left;
     }
@@ -284,26 +585,392 @@ void growrec(tree_t* t, node_t* root, dataset_t* d, int depth){
      * This makes valid obtain its original state 
      * (One can verify this by adding up all the transformations)
      */
-    for(i=l; i<u; i++)
-        t->valid[b[i].example]-=1;
+    if(statsOn)
+        start = wallClock();
+    if(t->cluster)
+        pushSplit(t, d, &best);
+    shiftValid(t, d, best.feature, best.threshold, -1);
+    if(statsOn)
+        t->stats.sweep += wallClock() - start;
     growrec(t, first, d, depth+1);
-    for(i=l; i<u; i++)
-        t->valid[b[i].example]+=2;
+    if(statsOn)
+        start = wallClock();
+    shiftValid(t, d, best.feature, best.threshold, 2);
     for(i=0; i<d->nex; i++)
         t->valid[i]-=1;
+    if(statsOn)
+        t->stats.sweep += wallClock() - start;
     growrec(t, second, d, depth+1);
-    for(i=l; i<u; i++)
-        t->valid[b[i].example]-=1;
+    if(statsOn)
+        start = wallClock();
+    shiftValid(t, d, best.feature, best.threshold, -1);
     for(i=0; i<d->nex; i++)
         t->valid[i]+=1;
+    if(t->cluster)
+        popSplit(t->cluster);
+    t->stats.swept += 2*d->nex;
+    if(statsOn)
+        t->stats.sweep += wallClock() - start;
     /* Unmark the feature */
     if(!d->cont[best.feature])
         t->used[best.feature]=0;
 }
 
+/* A node of the level that growLevels is growing, with the state of the
+ * scan of the current feature at that node */
+typedef struct level_t{
+    node_t* node;
+    split_t best;
+    int* path;   /* the binary features split on above the node */
+    int npath;
+    int n;       /* examples that reach the node */
+    int open;    /* are splits of the node searched? */
+    int on;      /* is the current feature a candidate at the node? */
+    int first;   /* index of its first child in the next level, -1 for a leaf */
+    int count;   /* pairs of the current feature at the node */
+    int prevex;
+    float lo,hi,prev,threshold,pred;
+    float posnonzero,negnonzero,poszero,negzero,posleft,negleft;
+} level_t;
+
+/* The search of scanFeatures (or randomSplit) for feature i at every node
+ * of a level that has on set, in two passes over the pairs of i. A node
+ * meets its examples in the same order as with valid[], so it evaluates
+ * the same thresholds with the same masses. */
+static void scanLevel(tree_t* t, dataset_t* d, int i, level_t* lv, int nn, const int* nodeof){
+    evpair_t* fi = treeColumn(t,d,i);
+    level_t* s;
+    int j,k,ex;
+
+    assert(d->dense[i] == NULL);
+    for(k=0; k<nn; k++){
+        lv[k].count = 0;
+        lv[k].posnonzero = lv[k].negnonzero = d->cont[i] ? FLT_EPSILON : 0;
+    }
+    /* The mass of the nonzero values and their range at each node */
+    for(j=0; j<d->size[i]; j++){
+        ex = fi[j].example;
+        k = nodeof[ex];
+        if(k<0 || !lv[k].on)
+            continue;
+        s = lv+k;
+        if(s->count++ == 0)
+            s->lo = fi[j].value;
+        s->hi = fi[j].value;
+        if(d->target[ex])
+            s->posnonzero += d->weight[ex];
+        else
+            s->negnonzero += d->weight[ex];
+    }
+    t->stats.nonzeros += d->size[i];
+    if(!d->cont[i]){ /* The nonzero mass is the one that goes right */
+        for(k=0; k<nn; k++){
+            s = lv+k;
+            if(s->on)
+                updateSplit(i,0.5,max(FLT_EPSILON, s->node->pos - s->posnonzero),
+                    max(FLT_EPSILON, s->node->neg - s->negnonzero),s->node,&s->best);
+        }
+        return;
+    }
+    for(k=0; k<nn; k++){
+        s = lv+k;
+        if(!s->on)
+            continue;
+        if(s->count == 0){
+            s->on = 0;
+            continue;
+        }
+        s->poszero = max(FLT_EPSILON, s->node->pos - s->posnonzero);
+        s->negzero = max(FLT_EPSILON, s->node->neg - s->negnonzero);
+        s->posleft = FLT_EPSILON;
+        s->negleft = FLT_EPSILON;
+        s->prevex = -1;
+        if(t->committee == EXTRATREES){
+            s->threshold = randomThreshold(t, s->lo, s->hi, s->count < s->n);
+            s->on = s->threshold != 0;
+        }
+        else if(s->lo > 0){
+            s->posleft += s->poszero;
+            s->negleft += s->negzero;
+            updateSplit(i,0.5*(0 + s->lo),s->posleft,s->negleft,s->node,&s->best);
+        }
+    }
+    /* The sweep over the values, see scanFeatures */
+    for(j=0; j<d->size[i]; j++){
+        ex = fi[j].example;
+        k = nodeof[ex];
+        if(k<0 || !lv[k].on)
+            continue;
+        s = lv+k;
+        if(t->committee == EXTRATREES){
+            if(fi[j].value <= s->threshold){
+                if(d->target[ex])
+                    s->posleft += d->weight[ex];
+                else
+                    s->negleft += d->weight[ex];
+            }
+            continue;
+        }
+        if(s->prevex < 0){
+            s->prevex = ex;
+            s->prev = fi[j].value;
+            continue;
+        }
+        if(d->target[s->prevex])
+            s->posleft += d->weight[s->prevex];
+        else
+            s->negleft += d->weight[s->prevex];
+        if(s->prev < 0 && 0 < fi[j].value){
+            updateSplit(i,0.5*(s->prev + 0),s->posleft,s->negleft,s->node,&s->best);
+            s->posleft += s->poszero;
+            s->negleft += s->negzero;
+            updateSplit(i,0.5*(0 + fi[j].value),s->posleft,s->negleft,s->node,&s->best);
+        }
+        if(fi[j].value != s->prev)
+            updateSplit(i,0.5*(fi[j].value + s->prev),s->posleft,s->negleft,s->node,&s->best);
+        s->prev = fi[j].value;
+        s->prevex = ex;
+    }
+    if(t->committee != EXTRATREES)
+        return;
+    for(k=0; k<nn; k++){
+        s = lv+k;
+        if(!s->on)
+            continue;
+        if(s->threshold > 0){
+            s->posleft += s->poszero;
+            s->negleft += s->negzero;
+        }
+        updateSplit(i,s->threshold,s->posleft,s->negleft,s->node,&s->best);
+    }
+}
+
+/* Grow the tree breadth first, for data that is read from disk (-m). The
+ * nodes of a level are all searched in one pass over each column and
+ * nodeof[x] is the node of the level that example x reaches (-1 if none),
+ * so a column is read once per level instead of once per node. Bagging and
+ * boosting grow the same trees as growrec. Random forests and extra trees
+ * draw the features and thresholds of the nodes in another order, so their
+ * trees are different ones from the same distribution. */
+static void growLevels(tree_t* t, dataset_t* d){
+    int i,ii,j,k,p,f,n,m,nn,nnext,depth,active,nfeat;
+    int random = t->committee == RANDOMFOREST || t->committee == EXTRATREES;
+    int* nodeof = malloc(d->nex*sizeof(int));
+    int* stamp = malloc(d->nfeat*sizeof(int));
+    int* head = malloc((d->nfeat+1)*sizeof(int));
+    int* at = malloc(d->nfeat*sizeof(int));
+    int* cnode = NULL;
+    int* cfeat = NULL;
+    int* list = NULL;
+    int* paths = NULL;
+    int* nextpaths;
+    level_t* lv = malloc(sizeof(level_t));
+    level_t* next;
+    level_t* s;
+    node_t* root;
+    evpair_t* b;
+    double start=0;
+
+    for(i=0; i<d->nex; i++)
+        nodeof[i] = t->valid[i]>0 ? 0 : -1;
+    for(f=0; f<d->nfeat; f++)
+        stamp[f] = -1;
+    lv[0].node = t->root;
+    lv[0].npath = 0;
+    nn = 1;
+    for(depth=0; nn>0; depth++){
+        t->stats.nodes += nn;
+        if(depth > t->stats.depth)
+            t->stats.depth = depth;
+        if(statsOn)
+            start = wallClock();
+        for(k=0; k<nn; k++)
+            lv[k].n = 0;
+        for(i=0; i<d->nex; i++){
+            if(nodeof[i]>=0)
+                lv[nodeof[i]].n += 1;
+        }
+        /* Search the nodes that are neither too deep nor pure, see growrec */
+        for(active=0, k=0; k<nn; k++){
+            s = lv+k;
+            root = s->node;
+            s->on = 0;
+            s->open = depth<t->maxdepth && root->pos > FLT_EPSILON && root->neg > FLT_EPSILON;
+            s->best.feature = -1;
+            s->best.tried = s->best.improved = 0;
+            s->best.gain = -entropy(root->pos/(root->pos+root->neg));
+            active += s->open;
+        }
+        nfeat = random ? d->nfeat : t->fpn;
+        if(active && random){
+            /* Every node draws its features as in bestSplit. Then the
+             * nodes that consider feature f are list[head[f]..head[f+1]-1] */
+            cnode = realloc(cnode, active*t->fpn*sizeof(int));
+            cfeat = realloc(cfeat, active*t->fpn*sizeof(int));
+            list = realloc(list, active*t->fpn*sizeof(int));
+            memset(head, 0, (d->nfeat+1)*sizeof(int));
+            for(m=0, k=0; k<nn; k++){
+                s = lv+k;
+                if(!s->open)
+                    continue;
+                for(p=0; p<s->npath; p++)
+                    t->used[s->path[p]] = 1;
+                randomSubset(t->feats, d->nfeat, t->fpn, t->used, &t->seed);
+                for(j=0; j<t->fpn; j++){
+                    f = t->feats[j];
+                    if(t->used[f])
+                        continue;
+                    head[f+1] += 1;
+                    cnode[m] = k;
+                    cfeat[m++] = f;
+                }
+                for(p=0; p<s->npath; p++)
+                    t->used[s->path[p]] = 0;
+            }
+            for(f=0; f<d->nfeat; f++){
+                head[f+1] += head[f];
+                at[f] = head[f];
+            }
+            for(j=0; j<m; j++)
+                list[at[cfeat[j]]++] = cnode[j];
+        }
+        for(ii=0; active && ii<nfeat; ii++){
+            f = random ? ii : t->feats[ii];
+            /* A feature without pairs cannot split the node, see scanFeatures */
+            if(d->size[f]==0)
+                continue;
+            n = 0;
+            if(random){
+                for(j=head[f]; j<head[f+1]; j++, n++)
+                    lv[list[j]].on = 1;
+            }
+            else{
+                for(k=0; k<nn; k++){
+                    s = lv+k;
+                    s->on = s->open;
+                    for(p=0; s->on && p<s->npath; p++)
+                        s->on = s->path[p] != f;
+                    n += s->on;
+                }
+            }
+            if(n==0)
+                continue;
+            t->stats.features += n;
+            scanLevel(t, d, f, lv, nn, nodeof);
+            for(k=0; k<nn; k++)
+                lv[k].on = 0;
+        }
+        if(statsOn){
+            t->stats.split += wallClock() - start;
+            start = wallClock();
+        }
+
+        /* Install the splits. The children of node k are next[first] and
+         * next[first+1], the one that the examples without the feature
+         * reach first as in growrec. */
+        for(nnext=0, k=0; k<nn; k++){
+            s = lv+k;
+            root = s->node;
+            s->first = -1;
+            if(s->open){
+                t->stats.thresholds += s->best.tried;
+                t->stats.updates += s->best.improved;
+            }
+            if(!s->open || s->best.feature < 0 ||
+                    (s->best.posleft <= FLT_EPSILON && s->best.negleft <= FLT_EPSILON) ||
+                    (s->best.posright <= FLT_EPSILON && s->best.negright <= FLT_EPSILON)){
+                root->split = -1;
+                t->stats.leaves += 1;
+                s->pred = 0.5f*logf((root->pos+EPS)/(root->neg+EPS));
+                continue;
+            }
+            root->split = s->best.feature;
+            root->threshold = s->best.threshold;
+            root->left = malloc(sizeof(node_t));
+            root->left->pos = s->best.posleft;
+            root->left->neg = s->best.negleft;
+            root->right = malloc(sizeof(node_t));
+            root->right->pos = s->best.posright;
+            root->right->neg = s->best.negright;
+            s->first = nnext;
+            nnext += 2;
+        }
+        next = malloc((nnext+1)*sizeof(level_t));
+        nextpaths = malloc((nnext*(depth+1)+1)*sizeof(int));
+        for(k=0; k<nn; k++){
+            s = lv+k;
+            if(s->first < 0)
+                continue;
+            root = s->node;
+            next[s->first].node = root->threshold > 0 ? root->left : root->right;
+            next[s->first+1].node = root->threshold > 0 ? root->right : root->left;
+            /* Both children inherit the path, and a binary feature is used up */
+            for(j=s->first; j<s->first+2; j++){
+                next[j].path = nextpaths + j*(depth+1);
+                next[j].npath = s->npath;
+                for(p=0; p<s->npath; p++)
+                    next[j].path[p] = s->path[p];
+                if(!d->cont[root->split])
+                    next[j].path[next[j].npath++] = root->split;
+            }
+        }
+
+        /* The examples that splitRange selects go to the second child.
+         * Each feature that splits nodes of the level is read once and
+         * nodeof[x] is -2-c until every split is done, if x goes to c. */
+        for(k=0; k<nn; k++){
+            if(lv[k].first < 0 || stamp[lv[k].node->split] == depth)
+                continue;
+            f = lv[k].node->split;
+            stamp[f] = depth;
+            b = treeColumn(t,d,f);
+            for(j=0; j<d->size[f]; j++){
+                i = nodeof[b[j].example];
+                if(i<0 || lv[i].first<0 || lv[i].node->split != f)
+                    continue;
+                root = lv[i].node;
+                if(root->threshold > 0 ? b[j].value > root->threshold : b[j].value <= root->threshold)
+                    nodeof[b[j].example] = -2 - (lv[i].first+1);
+            }
+            t->stats.swept += d->size[f];
+        }
+        for(i=0; i<d->nex; i++){
+            k = nodeof[i];
+            if(k <= -2)
+                nodeof[i] = -2 - k;
+            else if(k >= 0 && lv[k].first >= 0)
+                nodeof[i] = lv[k].first;
+            else if(k >= 0){
+                /* As stopGrowing, the examples of a leaf get its output */
+                if(t->committee == BOOSTING)
+                    t->pred[i] = lv[k].pred;
+                nodeof[i] = -1;
+            }
+        }
+        t->stats.swept += d->nex;
+        if(statsOn)
+            t->stats.sweep += wallClock() - start;
+        free(lv);
+        free(paths);
+        lv = next;
+        paths = nextpaths;
+        nn = nnext;
+    }
+    free(lv);
+    free(paths);
+    free(nodeof);
+    free(stamp);
+    free(head);
+    free(at);
+    free(cnode);
+    free(cfeat);
+    free(list);
+}
+
 void grow(tree_t* t, dataset_t* d){
     int i;
 
+    memset(&t->stats, 0, sizeof(treestats_t));
     /* Initialize root fields */
     t->root = malloc(sizeof(node_t));
     t->root->pos = FLT_EPSILON;
@@ -318,12 +985,19 @@ void grow(tree_t* t, dataset_t* d){
     }
     t->root->pos = min(1-FLT_EPSILON, t->root->pos);
     t->root->neg = min(1-FLT_EPSILON, t->root->neg);
+    if(t->cluster)
+        clusterRoot(t->cluster, t->root);
     /* Recursively grow tree */
-    growrec(t, t->root, d, 0);
+    if(t->levels)
+        growLevels(t, d);
+    else
+        growrec(t, t->root, d, 0);
 }
 
 float classifyBag(node_t* t, float* example){
     if(t->split < 0){
+        if(t->split == OUTPUTLEAF)
+            return t->threshold;
         if(t->pos <= FLT_EPSILON)
             return 0;
         if(t->neg <= FLT_EPSILON)
@@ -338,12 +1012,50 @@ float classifyBag(node_t* t, float* example){
     }
 }
 
+/* Replace the feature of every split by map[feature] */
+void renumberTree(node_t* t, const int* map){
+    if(t->split < 0)
+        return;
+    t->split = map[t->split];
+    renumberTree(t->left, map);
+    renumberTree(t->right, map);
+}
+
+/* Number of nodes classifyBag or classifyBoost visit, the leaf included */
+int pathLength(node_t* t, const float* example){
+    int n;
+    for(n=1; t->split >= 0; n++)
+        t = example[t->split] <= t->threshold ? t->left : t->right;
+    return n;
+}
+
+/* Store in every leaf the output that classifyBag or classifyBoost would
+ * compute from its masses, so that treeOutput is just a walk down the tree.
+ * The threshold of a leaf is not used otherwise. */
+void setOutputs(node_t* t, int committee){
+    if(t->split >= 0){
+        setOutputs(t->left, committee);
+        setOutputs(t->right, committee);
+    }
+    else if(t->split != OUTPUTLEAF)
+        t->threshold = committee == BOOSTING ? classifyBoost(t, NULL) : classifyBag(t, NULL);
+}
+
+/* Output of the tree for example; setOutputs must have been called */
+float treeOutput(node_t* t, const float* example){
+    while(t->split >= 0)
+        t = example[t->split] <= t->threshold ? t->left : t->right;
+    return t->threshold;
+}
+
 /* This is suggested by Schapire and Singer in their paper
 "Improved boosting algorithms using confidence-rated predictions"
 Machine Learning Journal 1999 
 */
 float classifyBoost(node_t* t, float* example){
     if(t->split < 0){
+        if(t->split == OUTPUTLEAF)
+            return t->threshold;
         return 0.5*logf((t->pos+EPS)/(t->neg+EPS));
     }
     else{
@@ -354,11 +1066,29 @@ float classifyBoost(node_t* t, float* example){
     }
 }
 
+/* Find the smallest and largest output of any leaf of the tree */
+void outputRange(node_t* t, int committee, float* lo, float* hi){
+    float v;
+    if(t->split < 0){
+        if(t->split == OUTPUTLEAF)
+            v = t->threshold;
+        else if(committee == BOOSTING)
+            v = 0.5*logf((t->pos+EPS)/(t->neg+EPS));
+        else
+            v = classifyBag(t, NULL);
+        *lo = min(*lo, v);
+        *hi = max(*hi, v);
+    }
+    else{
+        outputRange(t->left, committee, lo, hi);
+        outputRange(t->right, committee, lo, hi);
+    }
+}
+
 void classifyTrainingData(tree_t* t, node_t* root, dataset_t* d){
-    int i,k,l,u;
+    int i;
     node_t* first;
     node_t* second;
-    evpair_t* b;
 
     /* Classify all valid points here */
     if ( root->split < 0 ){
@@ -375,99 +1105,91 @@ void classifyTrainingData(tree_t* t, node_t* root, dataset_t* d){
     See the comments there for an explanation.
     */
 
-    b = d->feature[root->split];
-    k = 0;
-    u = d->size[root->split];
-    while (k < u) {
-        i = (k + u)/2;
-        if (b[i].value > root->threshold)
-            u = i;
-        else
-            k = i + 1;
-    }
     if ( root->threshold > 0 ){
-        l=k;
-        u=d->size[root->split];
         first = root->left;
         second = root->right;
     }
     else{
-        l=0;
-        u=k;
         first = root->right;
         second = root->left;
     }
-    for ( i=l; i<u; i++ )
-        t->valid[b[i].example]-=1;
+    shiftValid(t, d, root->split, root->threshold, -1);
     classifyTrainingData ( t, first, d );
-    for ( i=l; i<u; i++ )
-        t->valid[b[i].example]+=2;
+    shiftValid(t, d, root->split, root->threshold, 2);
     for ( i=0; i<d->nex; i++ )
         t->valid[i]-=1;
     classifyTrainingData ( t, second, d );
-    for ( i=l; i<u; i++ )
-        t->valid[b[i].example]-=1;
+    shiftValid(t, d, root->split, root->threshold, -1);
     for ( i=0; i<d->nex; i++ )
         t->valid[i]+=1;
 }
 
-void classifyOOBData(tree_t* t, node_t* root, dataset_t* d){
-    int i,k,l,u;
+/* Send the examples ex[0..n-1] down the tree and record in leaf[] the leaf
+ * that each of them reaches. Instead of sweeping over all the examples like
+ * classifyTrainingData, the list is partitioned at every node, so the cost
+ * depends only on n and the part of the split columns that is scanned.
+ * mark must have room for every example and be all zeros; it is left that way.
+ * buf is used to decode the columns of packed data (see columnBuffer).
+ */
+void routeExamples(node_t* root, dataset_t* d, int* ex, int n, int* mark, node_t** leaf, evpair_t* buf){
+    int i,j,k,l,u;
     node_t* first;
     node_t* second;
-    evpair_t* b;
+    evpair_t* b = NULL;
+    dense_t* dn;
+    unsigned char sel[MAXBINS];
 
-    /* Classify all out of bag points here */
-    if ( root->split < 0 ){
-        float pred=root->pos/(root->pos+root->neg);
-        for(i=0; i<d->nex; i++){
-            if(t->valid[i] > 0 && d->weight[i]<=0)
-                t->pred[i] = pred;
-        }
+    if(n == 0)
+        return;
+    if(root->split < 0){
+        for(j=0; j<n; j++)
+            leaf[ex[j]] = root;
         return;
     }
 
-    /*The rest is similar to the recursive tree growing procedure 
-    See the comments there for an explanation.
-    */
-
-    b = d->feature[root->split];
-    k = 0;
-    u = d->size[root->split];
-    while (k < u) {
-        i = (k + u)/2;
-        if (b[i].value > root->threshold)
-            u = i;
-        else
-            k = i + 1;
-    }
     if ( root->threshold > 0 ){
-        l=k;
-        u=d->size[root->split];
         first = root->left;
         second = root->right;
     }
     else{
-        l=0;
-        u=k;
         first = root->right;
         second = root->left;
     }
-    for ( i=l; i<u; i++ )
-        t->valid[b[i].example]-=1;
-    classifyOOBData ( t, first, d );
-    for ( i=l; i<u; i++ )
-        t->valid[b[i].example]+=2;
-    for ( i=0; i<d->nex; i++ )
-        t->valid[i]-=1;
-    classifyOOBData ( t, second, d );
-    for ( i=l; i<u; i++ )
-        t->valid[b[i].example]-=1;
-    for ( i=0; i<d->nex; i++ )
-        t->valid[i]+=1;
+    /* Mark the examples that are separated from the zeros exactly as in growrec.
+     * The feature may not exist in d if it is not the training set. */
+    dn = NULL;
+    l = u = 0;
+    if(root->split < d->nfeat && d->dense[root->split]){
+        dn = d->dense[root->split];
+        splitBins(dn, root->threshold, sel);
+        for(j=0; j<n; j++)
+            mark[ex[j]] = sel[dn->bin[ex[j]]];
+    }
+    else if(root->split < d->nfeat){
+        b = getColumn(d, root->split, buf);
+        splitRange(b, d->size[root->split], root->threshold, &l, &u);
+        for(i=l; i<u; i++)
+            mark[b[i].example]=1;
+    }
+    /* Move the unmarked examples to the front */
+    for(i=0, j=0; j<n; j++){
+        if(!mark[ex[j]]){
+            k = ex[i];
+            ex[i] = ex[j];
+            ex[j] = k;
+            i++;
+        }
+    }
+    if(dn){
+        for(j=0; j<n; j++)
+            mark[ex[j]]=0;
+    }
+    for(j=l; j<u; j++)
+        mark[b[j].example]=0;
+    routeExamples(first, d, ex, i, mark, leaf, buf);
+    routeExamples(second, d, ex+i, n-i, mark, leaf, buf);
 }
 
-
 void freeTree(node_t* t){
     if(t->split < 0){
         free(t);
@@ -481,12 +1203,15 @@ void freeTree(node_t* t){
 
 void writerec(FILE* fp, node_t* root){
     if(root->split >= 0){
-        fprintf(fp,"%d %g ",root->split, root->threshold);
+        fprintf(fp,"%d %.9g ",root->split, root->threshold);
         writerec(fp,root->left);
         writerec(fp,root->right);
     }
+    else if(root->split == OUTPUTLEAF){
+        fprintf(fp,"%d %.9g ",root->split, root->threshold);
+    }
     else{
-        fprintf(fp,"%d %g %g ",root->split, root->pos, root->neg);
+        fprintf(fp,"%d %.9g %.9g ",root->split, root->pos, root->neg);
     }
 }
 
@@ -496,24 +1221,45 @@ void writeTree(FILE* fp, node_t* t){
 }
 
 
-node_t* readrec(FILE* fp){
+/* A node and its subtree, or NULL if the input ends before the subtree
+ * does or is not a tree over nfeat features */
+node_t* readrec(FILE* fp, int nfeat){
     node_t* root = malloc(sizeof(node_t));
-    if(fscanf(fp,"%d",&root->split)==EOF){
-        fprintf(stderr,"corrupt input file\n");
-        exit(1);
+    if(fscanf(fp,"%d",&root->split)!=1 || root->split >= nfeat || root->split < OUTPUTLEAF){
+        free(root);
+        return NULL;
     }
     if(root->split >= 0){
-        fscanf(fp,"%g",&(root->threshold));
-        root->left=readrec(fp);
-        root->right=readrec(fp);
+        root->left=root->right=NULL;
+        if(fscanf(fp,"%g",&(root->threshold))!=1 ||
+                (root->left=readrec(fp,nfeat))==NULL ||
+                (root->right=readrec(fp,nfeat))==NULL){
+            if(root->left)
+                freeTree(root->left);
+            free(root);
+            return NULL;
+        }
+    }
+    else if(root->split == OUTPUTLEAF){
+        root->pos=root->neg=0;
+        root->left=root->right=NULL;
+        if(fscanf(fp,"%g",&(root->threshold))!=1){
+            free(root);
+            return NULL;
+        }
     }
     else{
-        fscanf(fp,"%g%g",&root->pos, &root->neg);
         root->left=root->right=NULL;
+        if(fscanf(fp,"%g%g",&root->pos, &root->neg)!=2){
+            free(root);
+            return NULL;
+        }
     }
     return root;
 }
 
-void readTree(FILE* fp, node_t** t){
-    *t=readrec(fp);
+/* Returns 0 if fp does not hold a whole tree */
+int readTree(FILE* fp, node_t** t, int nfeat){
+    *t=readrec(fp,nfeat);
+    return *t != NULL;
 }
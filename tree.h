@@ -11,10 +11,16 @@
 #define TREE_H
 
 #include "dataset.h"
+#include "stats.h"
 
 #define BAGGING      1
 #define BOOSTING     2
 #define RANDOMFOREST 3
+#define EXTRATREES   4
+
+/* split of a leaf that has no class masses, only the output stored in its
+ * threshold (models written by festcompact). Other leaves have split -1. */
+#define OUTPUTLEAF  -2
 
 
 typedef struct node_t{
@@ -32,9 +38,19 @@ typedef struct tree_t{
     int* feats; /* Just a permutation of the features */
     int* valid; /* Is the ith example valid for consideration? */
     int* used; /* Is the ith feature used? */
+    evpair_t* column; /* decoded feature if the data is packed (see columnBuffer) */
+    int colfeat; /* feature currently decoded in column, -1 if none */
+    float* hist; /* positive and negative mass in each bin of a dense feature */
+    int* count; /* valid examples in each bin of a dense feature */
     int fpn; /* Features to consider per node */ 
+    int nvalid; /* valid examples of the node being split, for extra trees */
     int maxdepth; /* maximum depth the tree is allowed to reach */
     int committee; /* committee type */ 
+    int levels; /* grow breadth first, one pass over each column per level (data from -m) */
+    unsigned int seed; /* state of the random number generator of this tree */
+    treestats_t stats; /* work done growing the current tree */
+    struct cluster_t* cluster; /* if not NULL, grown with other processes that have other features (see cluster.c) */
+    struct pool_t* pool; /* if not NULL, its threads search for the splits (see pool.c) */
 } tree_t;
 
 typedef struct split_t{
@@ -45,15 +61,25 @@ typedef struct split_t{
     float posright;
     float negright;
     float gain;
+    int tried; /* candidate thresholds evaluated */
+    int improved; /* how many of them were the best so far */
 } split_t;
 
 
 void freeTree(node_t* t);
 void grow(tree_t* t, dataset_t* d);
+split_t bestSplit(tree_t* t, node_t* root, dataset_t* d);
+void scanFeatures(tree_t* t, node_t* root, dataset_t* d, int lo, int hi, split_t* best);
+int markSplit(tree_t* t, dataset_t* d, int f, float threshold, int* ex);
 void classifyTrainingData(tree_t* t, node_t* root, dataset_t* d);
-void classifyOOBData(tree_t* t, node_t* root, dataset_t* d);
+void routeExamples(node_t* root, dataset_t* d, int* ex, int n, int* mark, node_t** leaf, evpair_t* buf);
 float classifyBag(node_t* t, float* example);
 float classifyBoost(node_t* t, float* example);
+int pathLength(node_t* t, const float* example);
+void setOutputs(node_t* t, int committee);
+float treeOutput(node_t* t, const float* example);
+void renumberTree(node_t* t, const int* map);
+void outputRange(node_t* t, int committee, float* lo, float* hi);
 void writeTree(FILE* fp, node_t* t);
-void readTree(FILE* fp, node_t** t);
+int readTree(FILE* fp, node_t** t, int nfeat);
 #endif
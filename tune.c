@@ -0,0 +1,288 @@
+/***************************************************************************
+ * Author: Nikos Karampatziakis <nk@cs.cornell.edu>, Copyright (C) 2008    *
+ *                                                                         *
+ * Description: Parameter search. Grows forests for many configurations   *
+ *              from one copy of the data and keeps the best one.          *
+ *                                                                         *
+ * License: See LICENSE file that comes with this distribution             *
+ ***************************************************************************/
+
+#include "dataset.h"
+#include "tree.h"
+#include "forest.h"
+#include "metrics.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+
+typedef struct config_t{
+    int committee;
+    int maxdepth;
+    float param;
+    float wneg;
+    int trees;
+    float err;  /* validation error */
+    float auc;  /* validation area under the ROC curve */
+}config_t;
+
+/* State shared by the threads that grow the forests */
+typedef struct tune_t{
+    config_t* config;
+    int nconfig;
+    int next;          /* next configuration to be grown */
+    dataset_t* d;      /* training data, shared by all forests */
+    dataset_t* v;      /* validation data */
+    unsigned int seed;
+    forest_t best;     /* the forest with the highest validation AUC so far */
+    int bestconfig;
+    pthread_mutex_t lock;
+}tune_t;
+
+void* growConfigs(void* arg){
+    tune_t* tu = arg;
+    config_t* c;
+    forest_t f;
+    dataset_t view;
+    int i,j;
+    int* all = malloc(tu->v->nex*sizeof(int));
+    float* pred = malloc(tu->v->nex*sizeof(float));
+
+    for(i=0; i<tu->v->nex; i++)
+        all[i] = i;
+    while(1){
+        pthread_mutex_lock(&tu->lock);
+        j = tu->next++;
+        pthread_mutex_unlock(&tu->lock);
+        if(j >= tu->nconfig)
+            break;
+        c = &tu->config[j];
+        viewData(&view, tu->d);
+        initForest(&f, c->committee, c->maxdepth, c->param, c->trees, c->wneg, 0, tu->seed);
+        growForest(&f, &view);
+        classifyExamples(&f, tu->v, all, tu->v->nex, pred);
+        c->err = errorRate(pred, tu->v->target, tu->v->nex, c->committee == BOOSTING ? 0 : 0.5);
+        c->auc = areaUnderROC(pred, tu->v->target, tu->v->nex);
+        freeView(&view);
+
+        /* Keep the forest only if it is the best so far */
+        pthread_mutex_lock(&tu->lock);
+        if(tu->bestconfig < 0 || c->auc > tu->config[tu->bestconfig].auc){
+            if(tu->bestconfig >= 0)
+                freeForest(&tu->best);
+            tu->best = f;
+            tu->bestconfig = j;
+        }
+        else
+            freeForest(&f);
+        pthread_mutex_unlock(&tu->lock);
+    }
+    free(all);
+    free(pred);
+    return NULL;
+}
+
+/* Parse a comma separated list of numbers */
+int parseList(char* list, float** values){
+    int n;
+    char* c;
+    for(n=1, c=list; *c; c++)
+        n += *c == ',';
+    *values = malloc(n*sizeof(float));
+    for(n=0, c=strtok(list,","); c; c=strtok(NULL,","))
+        (*values)[n++] = atof(c);
+    return n;
+}
+
+int checkConfig(config_t* c){
+    if(c->committee!=BAGGING && c->committee!=BOOSTING && c->committee!=RANDOMFOREST && c->committee!=EXTRATREES){
+        fprintf(stderr,"Unknown committee type\n");
+        return 0;
+    }
+    if(c->maxdepth<=0 || c->wneg<0 || c->param<=0 || c->trees<=0){
+        fprintf(stderr,"Invalid configuration\n");
+        return 0;
+    }
+    return 1;
+}
+
+/* Read configurations from a file with one line of festlearn options
+ * (-c, -d, -n, -p, -t) per configuration. Missing options get the
+ * values in c. */
+int readConfigs(const char* name, config_t defaults, config_t** config){
+    FILE* fp;
+    char* line=0;
+    char* opt;
+    char* val;
+    size_t cap=0;
+    int n=0,size=16;
+    config_t c;
+
+    fp = fopen(name,"r");
+    if(fp == NULL){
+        fprintf(stderr,"Could not open file %s\n",name);
+        exit(1);
+    }
+    *config = malloc(size*sizeof(config_t));
+    while(getline(&line,&cap,fp) != -1){
+        c = defaults;
+        opt = strtok(line," \t\r\n");
+        if(opt == NULL || opt[0] == '#')
+            continue;
+        for(; opt; opt = strtok(NULL," \t\r\n")){
+            val = strtok(NULL," \t\r\n");
+            if(opt[0] != '-' || val == NULL){
+                fprintf(stderr,"Bad configuration in %s: %s\n",name,opt);
+                exit(1);
+            }
+            switch(opt[1]){
+                case 'c': c.committee=atoi(val); break;
+                case 'd': c.maxdepth=atoi(val); break;
+                case 'n': c.wneg=atof(val); break;
+                case 'p': c.param=atof(val); break;
+                case 't': c.trees=atoi(val); break;
+                default:
+                    fprintf(stderr,"Unknown option in %s: %s\n",name,opt);
+                    exit(1);
+            }
+        }
+        if(!checkConfig(&c))
+            exit(1);
+        if(n == size){
+            size *= 2;
+            *config = realloc(*config,size*sizeof(config_t));
+        }
+        (*config)[n++] = c;
+    }
+    free(line);
+    fclose(fp);
+    return n;
+}
+
+int main(int argc, char* argv[]){
+    dataset_t d;
+    dataset_t v;
+    tune_t tu;
+    config_t c;
+    config_t* config=0;
+    pthread_t* thread;
+    float* list[5];
+    int size[5];
+    int idx[5];
+    int i,k,n,option;
+    int threads=1;
+    char* listfile=0;
+    char* lists[5]={"2","1000","1","1","100"}; /* c d p n t */
+    unsigned int seed=time(0);
+
+    const char* help="Usage: %s [options] data validation model\nAvailable options:\n\
+    -c <list> : committee types (default: 2)\n\
+    -d <list> : maximum depths of the trees (default: 1000)\n\
+    -f <file> : read the configurations from this file, one line of\n\
+                festlearn options (-c -d -n -p -t) per configuration\n\
+    -j <int>  : number of forests grown at the same time (default: 1)\n\
+    -n <list> : relative weights for the negative class (default: 1)\n\
+    -p <list> : parameters for random forests (default: 1)\n\
+    -s <int>  : seed for the random number generator (default: time)\n\
+    -t <list> : numbers of trees (default: 100)\n\
+Lists are comma separated and every combination of their values is tried.\n\
+The forest with the highest AUC on the validation data is written to model.\n";
+
+    while((option=getopt(argc,argv,"c:d:f:j:n:p:s:t:"))!=EOF){
+        switch(option){
+            case 'c': lists[0]=optarg; break;
+            case 'd': lists[1]=optarg; break;
+            case 'f': listfile=optarg; break;
+            case 'j': threads=atoi(optarg); break;
+            case 'n': lists[3]=optarg; break;
+            case 'p': lists[2]=optarg; break;
+            case 's': seed=strtoul(optarg,NULL,10); break;
+            case 't': lists[4]=optarg; break;
+            case '?': fprintf(stderr,help,argv[0]); exit(1); break;
+        }
+    }
+    if(threads<=0){
+        fprintf(stderr,"Invalid number of threads\n");
+        exit(1);
+    }
+    if(argc - optind != 3){
+        fprintf(stderr,help,argv[0]);
+        exit(1);
+    }
+
+    for(k=0; k<5; k++){
+        lists[k] = strdup(lists[k]);
+        size[k] = parseList(lists[k],&list[k]);
+    }
+    if(listfile){
+        c.committee=list[0][0];
+        c.maxdepth=list[1][0];
+        c.param=list[2][0];
+        c.wneg=list[3][0];
+        c.trees=list[4][0];
+        n=readConfigs(listfile,c,&config);
+    }
+    else{
+        /* Enumerate the grid */
+        for(n=1, k=0; k<5; k++)
+            n *= size[k];
+        config = malloc(n*sizeof(config_t));
+        for(k=0; k<5; k++)
+            idx[k] = 0;
+        for(i=0; i<n; i++){
+            config[i].committee=list[0][idx[0]];
+            config[i].maxdepth=list[1][idx[1]];
+            config[i].param=list[2][idx[2]];
+            config[i].wneg=list[3][idx[3]];
+            config[i].trees=list[4][idx[4]];
+            if(!checkConfig(&config[i]))
+                exit(1);
+            for(k=4; k>=0 && ++idx[k] == size[k]; k--)
+                idx[k] = 0;
+        }
+    }
+    if(n == 0){
+        fprintf(stderr,"No configurations to try\n");
+        exit(1);
+    }
+
+    srand(seed);
+    loadData(argv[optind],&d);
+    loadData(argv[optind+1],&v);
+    alignData(&v, d.featid, d.nfeat);
+
+    tu.config = config;
+    tu.nconfig = n;
+    tu.next = 0;
+    tu.d = &d;
+    tu.v = &v;
+    tu.seed = seed;
+    tu.bestconfig = -1;
+    pthread_mutex_init(&tu.lock, NULL);
+    thread = malloc(threads*sizeof(pthread_t));
+    for(i=0; i<threads; i++)
+        pthread_create(&thread[i], NULL, growConfigs, &tu);
+    for(i=0; i<threads; i++)
+        pthread_join(thread[i], NULL);
+
+    printf("%9s  %5s  %6s  %6s  %5s  %6s  %6s\n","committee","depth","param","wneg","trees","err","auc");
+    for(i=0; i<n; i++){
+        printf("%9d  %5d  %6g  %6g  %5d  %5.2f%%  %6.4f%s\n",config[i].committee,config[i].maxdepth,
+            config[i].param,config[i].wneg,config[i].trees,100*config[i].err,config[i].auc,
+            i == tu.bestconfig ? "  *" : "");
+    }
+    writeForest(&tu.best, argv[optind+2]);
+    freeForest(&tu.best);
+    pthread_mutex_destroy(&tu.lock);
+    freeData(&d);
+    freeData(&v);
+    for(k=0; k<5; k++){
+        free(list[k]);
+        free(lists[k]);
+    }
+    free(config);
+    free(thread);
+    return 0;
+}
@@ -0,0 +1,44 @@
+/***************************************************************************
+ * Author: Nikos Karampatziakis <nk@cs.cornell.edu>, Copyright (C) 2008    *
+ *                                                                         *
+ * Description: Worker module. Holds part of the features of the data and  *
+ *              helps festlearn -g grow the trees.                         *
+ *                                                                         *
+ * License: See LICENSE file that comes with this distribution             *
+ ***************************************************************************/
+
+#include "dataset.h"
+#include "tree.h"
+#include "forest.h"
+#include "cluster.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <getopt.h>
+
+int main(int argc, char* argv[]){
+    dataset_t d;
+    forest_t f;
+    cluster_t c;
+    int option;
+    int pack=0;
+
+    const char* help="Usage: %s [options] address data\nWaits on address (host:port or the path of a Unix domain socket) for festlearn -g.\nUse - as data to read the standard input.\nAvailable options:\n\
+    -z        : keep the data compressed in memory, slower but smaller (default: no)\n";
+
+    while((option=getopt(argc,argv,"z"))!=EOF){
+        switch(option){
+            case 'z': pack=1; break;
+            case '?': fprintf(stderr,help,argv[0]); exit(1); break;
+        }
+    }
+    if(argc - optind != 2){
+        fprintf(stderr,help,argv[0]);
+        exit(1);
+    }
+    joinCluster(&c, &f, &d, argv[optind], argv[optind+1], pack);
+    growForest(&f, &d);
+    stopCluster(&c);
+    freeForest(&f);
+    freeData(&d);
+    return 0;
+}